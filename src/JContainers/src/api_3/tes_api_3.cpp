@@ -8,6 +8,8 @@
 #include <set>
 #include <thread>
 #include <array>
+#include <numeric>
+#include <random>
 
 #include <boost/filesystem.hpp>
 #include <boost/optional.hpp>
@@ -16,6 +18,7 @@
 
 #include "gtest.h"
 #include "util/util.h"
+#include "util/worker_pool.h"
 #include "jcontainers_constants.h"
 
 #include "skse/string.h"
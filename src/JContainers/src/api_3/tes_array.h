@@ -91,7 +91,7 @@ objectWithBooleans converts booleans into integers");
                 return nullptr;
             }
 
-            object_lock g(source);
+            object_shared_lock g(source);
 
             if (!validateReadIndexRange(source, startIndex, endIndex)) {
                 return nullptr;
@@ -114,7 +114,7 @@ objectWithBooleans converts booleans into integers");
                 return ;
             }
 
-            object_lock g2(another);
+            object_shared_lock g2(another);
 
             doWriteOp(obj, insertAtIndex, [&obj, &another](uint32_t whereTo) {
                 obj->_array.insert(obj->begin() + whereTo, another->begin(), another->end());
@@ -157,11 +157,7 @@ NEGATIVE_IDX_COMMENT);
         {
             JC_LOG_API ("%p, %d, ...", (void*) obj, index);
 
-            doReadOp(obj, index, [=, &t](uint32_t idx) {
-                t = obj->_array[idx].readAs<T>();
-            });
-
-            return t;
+            return readItem(obj, index, t);
         }
         REGISTERF(itemAtIndex<SInt32>, "getInt", "* index default=0", "Returns the item at the index of the array.\n"
             NEGATIVE_IDX_COMMENT);
@@ -181,7 +177,7 @@ NEGATIVE_IDX_COMMENT);
             if (!obj)
                 return v;
 
-            object_lock lck (obj);
+            object_shared_lock lck (obj);
             v.reserve (obj->_array.size ());
 
             for (auto& i : obj->_array)
@@ -204,7 +200,7 @@ NEGATIVE_IDX_COMMENT);
 
             int result = -1;
 
-            doReadOp(obj, pySearchStartIndex, [=, &result](uint32_t idx) {
+            doSharedReadOp(obj, pySearchStartIndex, [=, &result](uint32_t idx) {
                 if (pySearchStartIndex >= 0) {
                     auto itr = std::find(obj->begin() + idx, obj->end(), item(value));
                     result = itr != obj->end() ? (itr - obj->begin()) : -1;
@@ -234,7 +230,7 @@ NEGATIVE_IDX_COMMENT);
             SInt32 result = 0;
             if (obj) 
             {
-                object_lock g (obj);
+                object_shared_lock g (obj);
                 auto n = std::count (obj->u_container ().begin (), obj->u_container ().end (), item (value));
                 result = static_cast<SInt32> (n);
             }
@@ -344,7 +340,7 @@ If @addToIndex >= 0 it inserts value at given index. " NEGATIVE_IDX_COMMENT);
             JC_LOG_API ("%p, %d", (void*) obj, index);
 
             SInt32 type = item_type::no_item;
-            doReadOp(obj, index, [=, &type](uint32_t idx) {
+            doSharedReadOp(obj, index, [=, &type](uint32_t idx) {
                 type = obj->_array[idx].type();
             });
 
@@ -433,7 +429,7 @@ If @addToIndex >= 0 it inserts value at given index. " NEGATIVE_IDX_COMMENT);
                 return false;
             }
 
-            object_lock l(obj);
+            object_shared_lock l(obj);
             const auto readIdx = convertReadIndex(obj, py_readIdx);
             const int32_t countToRead = *lstIdx - *fstIdx + 1;
 
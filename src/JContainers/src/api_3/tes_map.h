@@ -31,8 +31,7 @@ namespace tes_api_3 {
         template<class T>
         static T getItem(tes_context& ctx, ref obj, key_cref key, T def = default_value<T>()) {
             JC_LOG_API ("%p, ..., ...", (void*) obj);
-            map_functions::doReadOp(obj, key, [&](item& itm) { def = itm.readAs<T>(); });
-            return def;
+            return map_functions::readItem(obj, key, def);
         }
         REGISTERF(getItem<SInt32>, "getInt", "object key default=0", "Returns the value associated with the @key. If not, returns @default value");
         REGISTERF(getItem<Float32>, "getFlt", "object key default=0.0", "");
@@ -74,11 +73,11 @@ namespace tes_api_3 {
             }
 
             return &array::objectWithInitializer([&](array &arr) {
-                object_lock g(obj);
+                object_shared_lock g(obj);
 
                 arr._array.reserve(obj->u_count());
                 for each(auto& pair in obj->u_container()) {
-                    arr.u_container().emplace_back(pair.first);
+                    arr.u_container().emplace_back(static_cast<const typename map_type::key_type&>(pair.first));
                 }
             },
                 ctx);
@@ -94,12 +93,12 @@ namespace tes_api_3 {
             }
 
             VMResultArray<tes_key> keys;
-            object_lock l(obj);
+            object_shared_lock l(obj);
             keys.reserve(obj->u_count());
             std::transform(obj->u_container().begin(), obj->u_container().end(),
                 std::back_inserter(keys),
                 [&ctx](const typename map_type::value_type& p) {
-                    return reflection::binding::get_converter<typename map_type::key_type>::convert2Tes(p.first);
+                    return reflection::binding::get_converter<typename map_type::key_type>::convert2Tes(static_cast<const typename map_type::key_type&>(p.first));
                 }
             );
 
@@ -116,7 +115,7 @@ namespace tes_api_3 {
             }
 
             return &array::objectWithInitializer([&](array &arr) {
-                object_lock g(obj);
+                object_shared_lock g(obj);
 
                 arr._array.reserve(obj->u_count());
                 for each(auto& pair in obj->u_container()) {
@@ -171,7 +170,7 @@ namespace tes_api_3 {
             }
 
             object_lock g(obj);
-            object_lock c(source);
+            object_shared_lock c(source);
 
             if (overrideDuplicates) {
                 for (const auto& pair : source->u_container()) {
@@ -321,4 +320,265 @@ Usage:
         EXPECT_EQ(countIterations(fmap), 2);
     }
 
+    // the keys of a JFormMap filled with actors: the std::map it used to be compared every key with
+    // form_ref::stable_less_comparer, which loads the deleted flag of both form entries
+    // the benchmark: run with --gtest_also_run_disabled_tests
+    JC_TEST_DISABLED(tes_form_map, perft_getInt)
+    {
+        enum { key_count = 50000, rounds = 10 };
+        namespace chr = std::chrono;
+
+        std::vector<form_ref_lightweight> keys;
+        std::vector<form_ref> refs;
+        for (uint32_t i = 0; i < key_count; ++i) {
+            const auto id = util::to_enum<FormId>(0x00010000 + i * 7919 % key_count);
+            keys.push_back(make_lightweight_form_ref(id, context));
+            refs.push_back(make_weak_form_id(id, context));
+        }
+
+        auto measure = [&](const char *what, auto&& read) {
+            int64_t sum = 0;
+            const auto started = chr::high_resolution_clock::now();
+            for (int round = 0; round < rounds; ++round) {
+                for (uint32_t i = 0; i < key_count; ++i) {
+                    sum += read(i);
+                }
+            }
+            const auto elapsed = chr::duration_cast<chr::microseconds>(chr::high_resolution_clock::now() - started);
+            EXPECT_EQ(sum, (int64_t)rounds * key_count);
+            JC_log("%s: %d keys, %d gets in %lld us", what, (int)key_count, (int)key_count * rounds, (int64_t)elapsed.count());
+        };
+
+        form_map* fmap = tes_object::object<form_map>(context);
+        std::map<form_ref, item, form_ref::stable_less_comparer> ordered;
+        for (uint32_t i = 0; i < key_count; ++i) {
+            tes_form_map::setItem<SInt32>(context, fmap, keys[i], 1);
+            ordered[refs[i]] = item{ 1 };
+        }
+
+        measure("JFormMap.getInt", [&](uint32_t i) { return tes_form_map::getItem<SInt32>(context, fmap, keys[i]); });
+        measure("std::map<form_ref> lookup", [&](uint32_t i) { return ordered.find(refs[i])->second.intValue(); });
+    }
+
+    // resolves handles the way Papyrus calls do: the handle gets converted into a retained object first
+    JC_TEST(tes_map, getInt_from_threads)
+    {
+        enum { thread_count = 4, calls_per_thread = 2000 };
+
+        std::vector<HandleT> handles;
+        for (int i = 0; i < thread_count; ++i) {
+            auto& obj = map::object(context);
+            obj.u_set("key", item{ i + 1 });
+            obj.tes_retain();
+            handles.push_back((HandleT)obj.uid());
+        }
+
+        // each thread resolves its own handle, the lock-free lookup must find the right object every time
+        std::atomic<int> mismatches{ 0 };
+        std::vector<std::thread> threads;
+        for (int t = 0; t < thread_count; ++t) {
+            threads.emplace_back([&, t]() {
+                for (int i = 0; i < calls_per_thread; ++i) {
+                    auto obj = reflection::binding::ObjectConverter<map>::convert2J(handles[t], context);
+                    if (tes_map::getItem<SInt32>(context, obj.get(), "key") != t + 1) {
+                        ++mismatches;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        EXPECT_EQ(mismatches.load(), 0);
+
+        for (auto hdl : handles) {
+            auto obj = context.getObject((Handle)hdl);
+            EXPECT_EQ(obj->ref_count<refs::stack>(), 0); // every lookup has given its reference back
+            obj->tes_release();
+        }
+    }
+
+    // the benchmark: run with --gtest_also_run_disabled_tests
+    JC_TEST_DISABLED(tes_map, perft_getInt_scaling)
+    {
+        enum { max_threads = 16, calls_per_thread = 200000 };
+        namespace chr = std::chrono;
+
+        std::vector<HandleT> handles;
+        for (int i = 0; i < max_threads; ++i) {
+            auto& obj = map::object(context);
+            obj.u_set("key", item{ i });
+            obj.tes_retain();
+            handles.push_back((HandleT)obj.uid());
+        }
+
+        for (int thread_count = 1; thread_count <= max_threads; thread_count *= 2) {
+            std::atomic<int64_t> checksum = 0;
+            std::vector<std::thread> threads;
+
+            const auto started = chr::high_resolution_clock::now();
+            for (int t = 0; t < thread_count; ++t) {
+                threads.emplace_back([&, t]() {
+                    int64_t sum = 0;
+                    for (int i = 0; i < calls_per_thread; ++i) {
+                        auto obj = reflection::binding::ObjectConverter<map>::convert2J(handles[t], context);
+                        sum += tes_map::getItem<SInt32>(context, obj.get(), "key");
+                    }
+                    checksum += sum;
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            const auto elapsed = chr::duration_cast<chr::microseconds>(chr::high_resolution_clock::now() - started);
+
+            EXPECT_EQ(checksum.load(), (int64_t)calls_per_thread * thread_count * (thread_count - 1) / 2);
+            JC_log("JMap.getInt: %d threads, %lld calls per thread, %lld us, %.2f Mcalls/s",
+                thread_count, (int64_t)calls_per_thread, (int64_t)elapsed.count(),
+                double(calls_per_thread) * thread_count / (std::max)((int64_t)elapsed.count(), (int64_t)1));
+        }
+
+        for (auto hdl : handles) {
+            context.getObject((Handle)hdl)->tes_release();
+        }
+    }
+
+    JC_TEST(tes_map, versioned_scalar_reads)
+    {
+        auto& obj = map::object(context);
+        EXPECT_EQ(tes_map::getItem<SInt32>(context, &obj, "key", -1), -1);
+
+        tes_map::setItem<SInt32>(context, &obj, "key", 1);
+        EXPECT_EQ(tes_map::getItem<SInt32>(context, &obj, "key"), 1);
+        EXPECT_EQ(tes_map::getItem<Float32>(context, &obj, "key"), 1.f);
+
+        // every exclusive access invalidates what the reader has seen
+        const auto version = obj.version();
+        tes_map::setItem<Float32>(context, &obj, "key", 2.5f);
+        EXPECT_NE(obj.version(), version);
+        EXPECT_EQ(tes_map::getItem<Float32>(context, &obj, "key"), 2.5f);
+        EXPECT_EQ(tes_map::getItem<SInt32>(context, &obj, "key"), 2);
+
+        tes_map::removeKey(context, &obj, "key");
+        EXPECT_EQ(tes_map::getItem<SInt32>(context, &obj, "key", -1), -1);
+    }
+
+    // clear takes no object_lock, but its exclusive lock still invalidates what the reader has seen
+    JC_TEST(tes_map, clear_invalidates_scalar_reads)
+    {
+        auto& obj = map::object(context);
+        tes_map::setItem<SInt32>(context, &obj, "key", 1);
+        EXPECT_EQ(tes_map::getItem<SInt32>(context, &obj, "key", -1), 1);
+        EXPECT_EQ(tes_map::getItem<Float32>(context, &obj, "key", -1.f), 1.f);
+
+        tes_map::clear(context, &obj);
+        EXPECT_EQ(tes_map::getItem<SInt32>(context, &obj, "key", -1), -1);
+        EXPECT_EQ(tes_map::getItem<Float32>(context, &obj, "key", -1.f), -1.f);
+
+        tes_map::setItem<SInt32>(context, &obj, "key", 2);
+        EXPECT_EQ(tes_map::getItem<SInt32>(context, &obj, "key", -1), 2);
+        tes_object::clear(context, &obj);
+        EXPECT_EQ(tes_map::getItem<SInt32>(context, &obj, "key", -1), -1);
+
+        auto& arr = array::object(context);
+        arr.u_push(item{ 3 });
+        EXPECT_EQ(tes_array::itemAtIndex<SInt32>(context, &arr, 0, -1), 3);
+        EXPECT_EQ(tes_array::itemAtIndex<Float32>(context, &arr, 0, -1.f), 3.f);
+
+        tes_array::clear(context, &arr);
+        EXPECT_EQ(tes_array::itemAtIndex<SInt32>(context, &arr, 0, -1), -1);
+        EXPECT_EQ(tes_array::itemAtIndex<Float32>(context, &arr, 0, -1.f), -1.f);
+    }
+
+    // 8 readers of a map and a writer, the reads go under the lock and through the version check.
+    // Logs the timings if @report is set
+    template<class Context>
+    void getInt_contention(Context& context, int calls_per_reader, bool report) {
+        enum { readers = 8, keys = 16 };
+        namespace chr = std::chrono;
+
+        auto& obj = map::object(context);
+        obj.tes_retain();
+        for (int k = 0; k < keys; ++k) {
+            obj.u_set(std::to_string(k), item{ 0 });
+        }
+
+        auto measure = [&](const char *name, std::function<SInt32(const char*)> read) {
+            for (int k = 0; k < keys; ++k) {
+                tes_map::setItem<SInt32>(context, &obj, std::to_string(k).c_str(), 0);
+            }
+
+            std::atomic<bool> stop{ false };
+            std::atomic<int> writes{ 0 };
+            std::thread writer([&]() {
+                while (!stop) {
+                    tes_map::setItem<SInt32>(context, &obj, std::to_string(writes % keys).c_str(), writes);
+                    ++writes;
+                    std::this_thread::sleep_for(chr::microseconds(100));
+                }
+            });
+
+            // the writer stores ascending values, each into the key the value maps to. A reader must never see
+            // a value go back or land in a foreign key
+            std::atomic<int> inconsistent{ 0 };
+            std::vector<std::thread> threads;
+            const auto started = chr::high_resolution_clock::now();
+            for (int t = 0; t < readers; ++t) {
+                threads.emplace_back([&, t]() {
+                    const std::string key = std::to_string(t % keys);
+                    SInt32 previous = 0;
+                    for (int i = 0; i < calls_per_reader; ++i) {
+                        const SInt32 value = read(key.c_str());
+                        if (value < previous || (value != 0 && value % keys != t % keys)) {
+                            ++inconsistent;
+                        }
+                        previous = value;
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            const auto elapsed = chr::duration_cast<chr::microseconds>(chr::high_resolution_clock::now() - started);
+            stop = true;
+            writer.join();
+
+            EXPECT_EQ(inconsistent.load(), 0);
+            // nothing stale is left once the writer is done
+            for (int k = 0; k < keys; ++k) {
+                SInt32 stored = 0;
+                tes_map::map_functions::doReadOp(&obj, std::to_string(k).c_str(), [&](item& itm) { stored = itm.readAs<SInt32>(); });
+                EXPECT_EQ(read(std::to_string(k).c_str()), stored);
+            }
+
+            if (report) {
+                JC_log("JMap.getInt %s: %d readers and a writer (%d writes), %lld us, %.2f Mcalls/s", name,
+                    (int)readers, writes.load(), (int64_t)elapsed.count(),
+                    double(calls_per_reader) * readers / (std::max)((int64_t)elapsed.count(), (int64_t)1));
+            }
+        };
+
+        measure("under the lock", [&](const char *key) {
+            SInt32 value = 0;
+            tes_map::map_functions::doReadOp(&obj, key, [&](item& itm) { value = itm.readAs<SInt32>(); });
+            return value;
+        });
+        measure("versioned", [&](const char *key) {
+            return tes_map::getItem<SInt32>(context, &obj, key);
+        });
+
+        obj.tes_release();
+    }
+
+    JC_TEST(tes_map, getInt_contention)
+    {
+        getInt_contention(context, 2000, false);
+    }
+
+    // the benchmark: run with --gtest_also_run_disabled_tests
+    JC_TEST_DISABLED(tes_map, perft_getInt_contention)
+    {
+        getInt_contention(context, 500000, true);
+    }
+
 }
@@ -98,12 +98,10 @@ Retains and returns the object.)==="
 
             if (tag && *tag)
             {
-                auto objects = ctx.filter_objects ([tag] (const object_base& obj) {
-                    return obj.has_equal_tag (tag);
-                });
+                auto objects = ctx.tagged_objects (tag);
 
                 for (auto& ref : objects) {
-                    while (ref->_tes_refCount != 0)
+                    while (ref->ref_count<refs::tes>() != 0)
                         ref->tes_release ();
                 }
             }
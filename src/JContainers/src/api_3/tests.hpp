@@ -178,18 +178,18 @@ namespace tes_api_3 {
 
         object_stack_ref obj2 = tes_object::object<map>(ctx);
         tes_object::retain(ctx, obj2);
-        EXPECT_TRUE(obj2->_tes_refCount == 1);
+        EXPECT_TRUE(obj2->ref_count<refs::tes>() == 1);
 
-        EXPECT_TRUE(obj->_tes_refCount == 0);
+        EXPECT_TRUE(obj->ref_count<refs::tes>() == 0);
         tes_object::retain(ctx, obj, "One very long line over 16 bytes so that a SSO triggers");
         tes_object::retain(ctx, obj, "uniqueTag");
-        EXPECT_TRUE(obj->_tes_refCount == 2);
+        EXPECT_TRUE(obj->ref_count<refs::tes>() == 2);
 
         tes_object::releaseObjectsWithTag(ctx, "uniqueTag");
-        EXPECT_TRUE(obj->_tes_refCount == 0);
+        EXPECT_TRUE(obj->ref_count<refs::tes>() == 0);
 
         // expect that obj2 ref. count left unmodified
-        EXPECT_TRUE(obj2->_tes_refCount == 1);
+        EXPECT_TRUE(obj2->ref_count<refs::tes>() == 1);
     }
 
     TEST(tes_map, nextKey)
@@ -216,8 +216,8 @@ namespace tes_api_3 {
         tes_object::addToPool(ctx, object_stack_ref(obj), "locationA");
         auto id = obj->public_id();
 
-        EXPECT_TRUE(obj->_refCount == 1);
-        EXPECT_TRUE(obj->_stack_refCount == 0);
+        EXPECT_TRUE(obj->ref_count<refs::object>() == 1);
+        EXPECT_TRUE(obj->ref_count<refs::stack>() == 0);
 
         tes_object::cleanPool(ctx, "locationA");
 
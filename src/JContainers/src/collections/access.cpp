@@ -72,7 +72,7 @@ namespace collections
             if (isKeyVisit) {
                 item itm;
                 for (auto &pair : copy) {
-                    itm = pair.first;
+                    itm = static_cast<const typename T::key_type&>(pair.first);
                     resolve(context, itm, rightPath, function);
                 }
             } else { // is value visit
@@ -442,7 +442,7 @@ namespace collections
                 if (!key) {
                     return bs::none;
                 }
-                object_lock lock(collection);
+                object_shared_lock lock(collection);
                 auto itemPtr = u_access_value(collection, key->key);
                 return itemPtr ? bs::make_optional(itemPtr->object()) : bs::none;
             }
@@ -108,7 +108,7 @@ namespace collections
         inline bs::optional<item> get(object_base& target, const char *cpath) {
             auto ac_info = access_constant(target, cpath);
             if (ac_info) {
-                object_lock g(ac_info->collection);
+                object_shared_lock g(ac_info->collection);
                 auto itmPtr = u_access_value(ac_info->collection, ac_info->key);
                 return _opt_from_pointer(itmPtr);
             }
@@ -137,7 +137,7 @@ namespace collections
         inline bs::optional<Value> get(object_base& target, const char *cpath) {
             auto ac_info = access_constant(target, cpath);
             if (ac_info) {
-                object_lock g(ac_info->collection);
+                object_shared_lock g(ac_info->collection);
                 auto itmPtr = u_access_value(ac_info->collection, ac_info->key);
                 return itmPtr ? _opt_from_pointer(itmPtr->get<Value>()) : bs::none;
             }
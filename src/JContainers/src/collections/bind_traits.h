@@ -28,6 +28,12 @@ namespace reflection { namespace binding {
         }
     };
 
+    // the stack references a Papyrus call takes get counted once, when the call returns
+    template<> struct call_scope < tes_context > {
+        stack_ref_batch batch;
+        explicit call_scope(tes_context&) {}
+    };
+
     template<> struct GetConv < object_stack_ref > : ObjectConverter<>{};
 
     template<> struct GetConv < object_base* > : ObjectConverter<>{};
@@ -34,6 +34,8 @@
 #include "forms/form_handling.h"
 
 #include "collections/collections.h"
+#include "collections/hashed_map_serialization.h"
+#include "collections/small_vector_serialization.h"
 #include "collections/context.h"
 
 #include "collections/context.hpp"
@@ -130,7 +132,7 @@ namespace collections {
             for (auto& pair : oldMap) {
                 form_ref key{ pair.first, fwatcher, form_ref::load_old_id };
                 if (key) {
-                    cnt.emplace(value_type{ std::move(key), std::move(pair.second) });
+                    cnt.insert(value_type{ form_key{ std::move(key) }, std::move(pair.second) });
                 }
             }
         }
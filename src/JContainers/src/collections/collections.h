@@ -6,6 +6,7 @@
 
 #include <boost/serialization/split_member.hpp>
 #include <boost/optional.hpp>
+#include <boost/container/small_vector.hpp>
 
 #include "common/ITypes.h"
 #include "common/IDebugLog.h"
@@ -13,8 +14,14 @@
 #include "skse/skse.h"
 
 #include "object/object_base.h"
+#include "object/object_context.h"
+#include "object/object_allocator.h"
 
 #include "collections/item.h"
+#include "collections/hashed_map.h"
+#include "collections/form_key.h"
+#include "collections/map_key.h"
+#include "util/istring.h"
 
 namespace collections {
 
@@ -42,21 +49,32 @@ namespace collections {
         typedef typename object_stack_ref_template<const T> cref;
 
         static T& make(object_context& context /*= tes_context::instance()*/) {
-            auto& obj = *new T();
+            auto& obj = context.allocator->make<T>();
             obj.set_context(context);
-            obj._registerSelf();
+            u_register(obj, context);
             return obj;
         }
 
         template<class Init>
         static T& _makeWithInitializer(Init& init, object_context& context /*= tes_context::instance()*/) {
-            auto& obj = *new T();
+            auto& obj = context.allocator->make<T>();
             obj.set_context(context);
             init(obj);
-            obj._registerSelf();
+            u_register(obj, context);
             return obj;
         }
 
+        // the registry throws once it runs out of slots, nothing owns the object then
+        static void u_register(T& obj, object_context& context) {
+            try {
+                obj._registerSelf();
+            }
+            catch (...) {
+                context.allocator->destroy(&obj);
+                throw;
+            }
+        }
+
         static T& object(object_context& context /*= tes_context::instance()*/) {
             return make(context);
         }
@@ -125,7 +143,10 @@ namespace collections {
 
         typedef SInt32 Index;
 
-        typedef std::vector<item> container_type;
+        // tuples, records, argument lists - most arrays are this small and allocate nothing
+        enum : size_t { inline_size = 8 };
+
+        typedef boost::container::small_vector<item, inline_size> container_type;
         typedef int32_t key_type;
         typedef container_type::iterator iterator;
         typedef container_type::reverse_iterator reverse_iterator;
@@ -141,7 +162,7 @@ namespace collections {
         }
 
         container_type container_copy() const {
-            object_lock g(this);
+            object_shared_lock g(this);
             return _array;
         }
 
@@ -164,6 +185,12 @@ namespace collections {
 
         void u_nullifyObjects() override;
 
+        std::shared_ptr<void> u_detach_contents() override {
+            auto contents = std::make_shared<container_type>();
+            contents->swap(_array);
+            return contents;
+        }
+
         void u_visit_referenced_objects(const std::function<void(object_base&)>& visitor) override {
             for (auto& item : _array) {
                 if (auto obj = item.object()) {
@@ -226,7 +253,7 @@ namespace collections {
         }
 
         boost::optional<item> get_item(int32_t index) const {
-            object_lock lock(this);
+            object_shared_lock lock(this);
             return _opt_from_pointer(u_get(index));
         }
 
@@ -257,6 +284,8 @@ namespace collections {
         template<class ContainerType>
         static util::choose_iterator<ContainerType> _find(ContainerType& c, const key_type& k) { return c.find(k); }
 
+        static void _erase(container_type& c, const_iterator itr) { c.erase(itr); }
+
     public:
 
         const container_type& u_container() const {
@@ -268,20 +297,20 @@ namespace collections {
         }
 
         container_type container_copy() const {
-            object_lock g(this);
+            object_shared_lock g(this);
             return cnt;
         }
 
         template<class Key>
         item findOrDef(const Key& key) const {
-            object_lock g(this);
+            object_shared_lock g(this);
             auto result = u_get(key);
             return result ? *result : item();
         }
 
         template<class Key>
         boost::optional<item> get_item(const Key& key) const {
-            object_lock g(this);
+            object_shared_lock g(this);
             auto result = u_get(key);
             return result ? *result : boost::optional<item>();
         }
@@ -313,7 +342,7 @@ namespace collections {
         template<class Key>
         bool u_erase(const Key& key) {
             typename container_type::iterator itr = RealType::_find(cnt, key);
-            return itr != cnt.end() ? (cnt.erase(itr), true) : false;
+            return itr != cnt.end() ? (RealType::_erase(cnt, itr), true) : false;
         }
 
         void u_clear() override {
@@ -321,7 +350,7 @@ namespace collections {
         }
 
         template<class T, class Key> item* u_set(const Key& key, T&& value) {
-            return &(cnt[key] = std::forward<T>(value));
+            return &(static_cast<RealType*>(this)->u_get_or_create(key) = std::forward<T>(value));
         }
 
         template<class T, class Key> void set(const Key& key, T&& value) {
@@ -358,18 +387,54 @@ namespace collections {
                 pair.second.u_nullifyObject();
             }
         }
-    };
 
-    struct map_case_insensitive_comp {
-        bool operator() (const std::string& lhs, const std::string& rhs) const {
-            return _stricmp(lhs.c_str(), rhs.c_str()) < 0;
+        std::shared_ptr<void> u_detach_contents() override {
+            auto contents = std::make_shared<container_type>();
+            contents->swap(cnt);
+            return contents;
         }
     };
 
+    // case-insensitive keys: equal keys have equal case-folded hashes.
+    // A few string comparisons of a binary search are cheaper than hashing only while the map is small
+    struct map_key_traits {
+        enum : size_t { flat_size = 16, inline_size = 4 };
+        static const bool flat_appends = false;
+
+        static uint32_t hash(const map_key& key) { return key.hash(); }
+        static uint32_t hash(const std::string& key) { return util::case_folded_hash(key.c_str(), key.size()); }
+        static uint32_t hash(const char *key) { return util::case_folded_hash(key); }
 
-    class map : public basic_map_collection< map, std::map<std::string, item, map_case_insensitive_comp > >
+        static bool equal(const map_key& key, const map_key& other) { return key.same_key(other); }
+        static bool equal(const map_key& key, const std::string& other) {
+            return key.size() == other.size() && _stricmp(key.c_str(), other.c_str()) == 0;
+        }
+        static bool equal(const map_key& key, const char *other) { return _stricmp(key.c_str(), other) == 0; }
+
+        static bool less(const map_key& key, const map_key& other) { return _stricmp(key.c_str(), other.c_str()) < 0; }
+        static bool less(const map_key& key, const std::string& other) { return _stricmp(key.c_str(), other.c_str()) < 0; }
+        static bool less(const map_key& key, const char *other) { return _stricmp(key.c_str(), other) < 0; }
+    };
+
+    // The entries keep interned keys (map_key), the map is accessed with std::string or const char * keys.
+    // A key gets interned only when a new entry gets added
+    class map : public basic_map_collection< map, hashed_map<map_key, item, map_key_traits> >
     {
     public:
+
+        using key_type = std::string;
+
+        template<class ContainerType, class Key>
+        static util::choose_iterator<ContainerType> _find(ContainerType& c, const Key& key) { return c.find(key); }
+
+        template<class Key>
+        item& u_get_or_create(const Key& key) {
+            return cnt[key];
+        }
+
+        // doesn't need the following entry, so the keys don't get sorted
+        static void _erase(container_type& c, const_iterator itr) { c.drop(itr); }
+
         enum  {
             TypeId = CollectionType::Map,
         };
@@ -380,32 +445,73 @@ namespace collections {
         void serialize(Archive & ar, const unsigned int version);
     };
 
-    class form_map : public basic_map_collection< form_map, std::map<form_ref, item, form_ref::stable_less_comparer> >
-    {
-    private:
-        using base = basic_map_collection< form_map, std::map<form_ref, item, form_ref::stable_less_comparer> >;
+    // a JIntMap filled in ascending order stays flat, whatever its size
+    struct integer_key_traits {
+        enum : size_t { flat_size = 64, inline_size = 4 };
+        static const bool flat_appends = true;
+
+        static uint32_t hash(int32_t key) {
+            // murmur3's finalizer - the table takes the low bits
+            uint32_t h = uint32_t(key);
+            h ^= h >> 16;
+            h *= 0x85ebca6bu;
+            h ^= h >> 13;
+            h *= 0xc2b2ae35u;
+            h ^= h >> 16;
+            return h;
+        }
+        static bool equal(int32_t key, int32_t other) { return key == other; }
+        static bool less(int32_t key, int32_t other) { return key < other; }
+    };
+
+    // FormIds of a JFormMap: the hash and the comparisons use form_key's copy of the raw id,
+    // the lookups with form_ref_lightweight (what Papyrus passes) touch nothing but integers
+    struct form_key_traits {
+        enum : size_t { flat_size = 32, inline_size = 0 };   // form maps are rarely small, JFormDB storages for instance
+        static const bool flat_appends = true;
+
+        static uint32_t hash(FormId id) { return integer_key_traits::hash(int32_t(id)); }
+        static uint32_t hash(const form_key& key) { return hash(key.id()); }
+        static uint32_t hash(const form_ref& key) { return hash(key.get_raw()); }
+        static uint32_t hash(const form_ref_lightweight& key) { return hash(key.get_raw()); }
+
+        static bool equal(const form_key& key, const form_key& other) { return key.id() == other.id(); }
+        static bool equal(const form_key& key, const form_ref& other) { return key.id() == other.get_raw(); }
+        static bool equal(const form_key& key, const form_ref_lightweight& other) { return key.id() == other.get_raw(); }
+
+        static bool less(const form_key& key, const form_key& other) { return key.id() < other.id(); }
+        static bool less(const form_key& key, const form_ref& other) { return key.id() < other.get_raw(); }
+        static bool less(const form_key& key, const form_ref_lightweight& other) { return key.id() < other.get_raw(); }
+    };
 
+    // An entry per raw FormId. The entry of a deleted form stays until the next load (see u_onLoaded),
+    // but can't be found: the id of a deleted dynamic form can be given to a new form
+    class form_map : public basic_map_collection< form_map, hashed_map<form_key, item, form_key_traits> >
+    {
     public:
 
-        // form_ref_lightweight support
+        using key_type = form_ref;
 
-        using base::_find;
-        using base::u_get_or_create;
+        // one check of the deleted flag per found entry - std::map<form_ref, ...> used to check it per comparison
+        template<class ContainerType, class Key>
+        static util::choose_iterator<ContainerType> _find(ContainerType& c, const Key& key) {
+            auto itr = c.find(key);
+            return itr != c.end() && itr->first.is_not_expired() ? itr : c.end();
+        }
 
-        template<class ContainerType>
-        static util::choose_iterator<ContainerType> _find(ContainerType& c, const form_ref_lightweight& k) {
-            auto comparer = c.key_comp();
-            auto itr = std::lower_bound(c.begin(), c.end(), k,
-                [comparer](const form_map::value_type& pair, const form_ref_lightweight& k) {
-                    return comparer(pair.first, k);
+        template<class Key>
+        item& u_get_or_create(const Key& key) {
+            auto itr = cnt.find(key);
+            if (itr != cnt.end()) {
+                if (itr->first.is_not_expired()) {
+                    return itr->second;
                 }
-            );
-            return itr != c.end() && itr->first == k ? itr : c.end();
+                cnt.drop(itr);  // the id has been given to a new form
+            }
+            return cnt[key];
         }
 
-        item& u_get_or_create(const form_ref_lightweight& key) {
-            return cnt[key.to_form_ref()];
-        }
+        static void _erase(container_type& c, const_iterator itr) { c.drop(itr); }
 
     public:
         enum  {
@@ -425,9 +531,12 @@ namespace collections {
         void save(Archive & ar, const unsigned int version) const;
     };
 
-    class integer_map : public basic_map_collection < integer_map, std::map<int32_t, item> >
+    class integer_map : public basic_map_collection < integer_map, hashed_map<int32_t, item, integer_key_traits> >
     {
     public:
+
+        static void _erase(container_type& c, const_iterator itr) { c.drop(itr); }
+
         enum  {
             TypeId = CollectionType::IntegerMap,
         };
@@ -435,4 +544,9 @@ namespace collections {
         template<class Archive>
         void serialize(Archive & ar, const unsigned int version);
     };
+
+    // the inline storage must not push the collections out of the allocator's slabs
+    static_assert(sizeof(array) <= object_allocator::max_object_size, "array is too large");
+    static_assert(sizeof(map) <= object_allocator::max_object_size, "map is too large");
+    static_assert(sizeof(integer_map) <= object_allocator::max_object_size, "integer_map is too large");
 }
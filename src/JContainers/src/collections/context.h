@@ -44,7 +44,7 @@ namespace collections
 
         std::atomic<map*> _cached_root = nullptr;
         std::atomic<Handle> _root_object_id{ Handle::Null };
-        spinlock _lazyRootInitLock;
+        counted_spinlock _lazyRootInitLock;
 
     public:
 
@@ -153,6 +153,7 @@ namespace collections {
 
     void tes_context::u_print_stats() const {
         base::u_print_stats();
+        JC_log("root lock contention: %llu contended acquisitions", _lazyRootInitLock.contention().contended);
     }
 
     void tes_context::read_from_string(const std::string & data) {
@@ -237,7 +238,7 @@ namespace collections {
         map * result = _cached_root.load(std::memory_order_acquire);
         if (!result) {
 
-            spinlock::guard g(_lazyRootInitLock);
+            counted_spinlock::guard g(_lazyRootInitLock);
 
             result = _cached_root.load(std::memory_order_relaxed);
             if (!result) {
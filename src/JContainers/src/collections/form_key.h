@@ -0,0 +1,59 @@
+#pragma once
+
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/level.hpp>
+#include <boost/serialization/tracking.hpp>
+
+#include "forms/form_id.h"
+#include "forms/form_observer.h"
+
+namespace collections {
+
+    // A JFormMap key - a form_ref with its raw FormId copied beside it. The map hashes and compares the copy,
+    // so a lookup doesn't dereference the watched form entry, unlike form_ref::stable_less_comparer.
+    // The raw id of a form entry never changes, the copy stays valid while the key lives
+    class form_key : public form_ref {
+        FormId _id = FormId::Zero;
+
+    public:
+
+        form_key() = default;
+
+        explicit form_key(const form_ref& ref) : form_ref(ref), _id(ref.get_raw()) {}
+        explicit form_key(form_ref&& ref) : form_ref(std::move(ref)) {
+            _id = get_raw();
+        }
+        // accesses form_observer - the map constructs a key only when it adds an entry
+        explicit form_key(const form_ref_lightweight& ref) : form_key(ref.to_form_ref()) {}
+
+        FormId id() const { return _id; }
+
+        const form_ref& ref() const { return *this; }
+
+        void swap(form_key& other) {
+            form_ref::swap(other);
+            std::swap(_id, other._id);
+        }
+
+        // boost.serialization: saved as form_ref
+        template<class Archive>
+        void save(Archive& ar, const unsigned int) const {
+            ar << ref();
+        }
+
+        template<class Archive>
+        void load(Archive& ar, const unsigned int) {
+            ar >> static_cast<form_ref&>(*this);
+            _id = get_raw();
+        }
+
+        template<class Archive>
+        void serialize(Archive& ar, const unsigned int version) {
+            boost::serialization::split_member(ar, *this, version);
+        }
+    };
+}
+
+// no class information, no tracking - a key is saved exactly as form_ref is
+BOOST_CLASS_IMPLEMENTATION(collections::form_key, boost::serialization::object_serializable)
+BOOST_CLASS_TRACKING(collections::form_key, boost::serialization::track_never)
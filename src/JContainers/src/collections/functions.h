@@ -1,12 +1,89 @@
 #pragma once
 
 #include <array>
+#include <string>
+#include <type_traits>
 #include <boost/optional.hpp>
 
 #include "collections/collections.h"
 
 namespace collections {
 
+    // A key a scalar_read_cache can store, see the specializations
+    template<class Key> struct scalar_cache_key { enum { cacheable = false }; };
+
+    template<> struct scalar_cache_key<const char *> {
+        enum { cacheable = true };
+        typedef std::string stored;
+        static size_t hash(const char *key) {
+            size_t h = 2166136261u;
+            for (; *key; ++key) {
+                h = (h ^ static_cast<unsigned char>(*key)) * 16777619u;
+            }
+            return h;
+        }
+    };
+
+    template<> struct scalar_cache_key<int32_t> {
+        enum { cacheable = true };
+        typedef int32_t stored;
+        static size_t hash(int32_t key) { return static_cast<size_t>(key) * 2654435761u; }
+    };
+
+    // Thread-local memo of scalar reads. An entry stays valid while the container's version stays the same,
+    // so that re-reading a value of an unchanged container takes no lock at all.
+    // The lookup itself can't run without the lock: a concurrent writer may rebalance the tree
+    // or reallocate the storage the lookup walks through
+    template<class Key, class Value>
+    class scalar_read_cache {
+        using key_traits = scalar_cache_key<Key>;
+
+        struct entry {
+            const object_base *object = nullptr; // never dereferenced
+            uint64_t version = 0;
+            typename key_traits::stored key = typename key_traits::stored();
+            boost::optional<Value> value;
+        };
+
+        enum { entry_count = 64 };
+        entry _entries[entry_count];
+
+        entry& entry_of(const object_base& obj, const Key& key) {
+            size_t h = key_traits::hash(key) ^ (reinterpret_cast<uintptr_t>(&obj) >> 4);
+            return _entries[h % entry_count];
+        }
+
+    public:
+
+        static scalar_read_cache& instance() {
+            static thread_local scalar_read_cache cache;
+            return cache;
+        }
+
+        // @read_locked reads the value under the container's lock if there is no valid entry
+        template<class ReadLocked>
+        boost::optional<Value> read(const object_base& obj, const Key& key, ReadLocked read_locked) {
+            entry& e = entry_of(obj, key);
+            if (e.object == &obj && e.version == obj.version() && e.key == key) {
+                return e.value;
+            }
+
+            boost::optional<Value> value;
+            uint64_t version;
+            {
+                // no writer can change the version while we hold the lock
+                object_shared_lock g(obj);
+                version = obj.version();
+                value = read_locked();
+            }
+            e.object = &obj;
+            e.version = version;
+            e.key = key;
+            e.value = value;
+            return value;
+        }
+    };
+
     class array_functions {
     public:
 
@@ -78,6 +155,45 @@ namespace collections {
             }
         }
 
+        // same as doReadOp, but readers don't block each other - @operation must not modify the array
+        template<class Op>
+        static void doSharedReadOp(const array * obj, index pyIndex, Op& operation) {
+            if (!obj) {
+                return;
+            }
+
+            object_shared_lock g(obj);
+            auto idx = convertReadIndex(obj, pyIndex);
+            if (idx) {
+                operation(*idx);
+            }
+        }
+
+        // reads an item converted to @T. Integers and floats usually get read without taking the lock
+        template<class T>
+        static T readItem(const array * obj, index pyIndex, T def) {
+            return readItem(obj, pyIndex, def, std::is_arithmetic<T>());
+        }
+
+        template<class T>
+        static T readItem(const array * obj, index pyIndex, T def, std::false_type) {
+            doSharedReadOp(obj, pyIndex, [&](index idx) { def = obj->u_container()[idx].readAs<T>(); });
+            return def;
+        }
+
+        template<class T>
+        static T readItem(const array * obj, index pyIndex, T def, std::true_type) {
+            if (!obj) {
+                return def;
+            }
+
+            auto value = scalar_read_cache<index, T>::instance().read(*obj, pyIndex, [obj, pyIndex]() {
+                auto idx = convertReadIndex(obj, pyIndex);
+                return idx ? boost::make_optional(obj->u_container()[*idx].readAs<T>()) : boost::optional<T>();
+            });
+            return value ? *value : def;
+        }
+
         template<class Op>
         static void doWriteOp(array * obj, index pyIndex, Op& operation) {
             if (!obj) {
@@ -109,10 +225,11 @@ namespace collections {
         using key_checker = map_key_checker/*<T>*/;
         ///typedef typename T::key_type key_type;
 
+        // the read operations must not modify the item - they run under a shared lock
         template<class Op, class R,/* class RAlter, */class key_type>
         static R doReadOpR(T * obj, const key_type& key, R default, Op& operation) {
             if (obj && key_checker::check(key)) {
-                object_lock g(obj);
+                object_shared_lock g(obj);
                 item *itm = obj->u_get(key);
                 return itm ? operation(*itm) : default;
             }
@@ -124,7 +241,7 @@ namespace collections {
         template<class Op, class key_type>
         static void doReadOp(T * obj, const key_type& key, Op& operation) {
             if (obj && key_checker::check(key)) {
-                object_lock g(obj);
+                object_shared_lock g(obj);
                 item *itm = obj->u_get(key);
                 if (itm) {
                     operation(*itm);
@@ -132,6 +249,33 @@ namespace collections {
             }
         }
 
+        // reads an item converted to @R. Integers and floats usually get read without taking the lock
+        template<class R, class key_type>
+        static R readItem(T * obj, const key_type& key, R def) {
+            using cached = std::integral_constant<bool,
+                std::is_arithmetic<R>::value && scalar_cache_key<key_type>::cacheable>;
+            return readItem(obj, key, def, cached());
+        }
+
+        template<class R, class key_type>
+        static R readItem(T * obj, const key_type& key, R def, std::false_type) {
+            doReadOp(obj, key, [&](item& itm) { def = itm.readAs<R>(); });
+            return def;
+        }
+
+        template<class R, class key_type>
+        static R readItem(T * obj, const key_type& key, R def, std::true_type) {
+            if (!obj || !key_checker::check(key)) {
+                return def;
+            }
+
+            auto value = scalar_read_cache<key_type, R>::instance().read(*obj, key, [obj, &key]() {
+                const item *itm = obj->u_get(key);
+                return itm ? boost::make_optional(itm->readAs<R>()) : boost::optional<R>();
+            });
+            return value ? *value : def;
+        }
+
         // force write into an item
         template<class Op, class key_type>
         static void doWriteOp(T * obj, const key_type& key, Op& operation) {
@@ -145,7 +289,7 @@ namespace collections {
         template<class KeyFunc, class KeyTypeIn>
         static void nextKey(const T *obj, const KeyTypeIn& lastKey, KeyFunc keyFunc) {
             if (obj) {
-                object_lock g(obj);
+                object_shared_lock g(obj);
                 auto& container = obj->u_container();
                 if (key_checker::check(lastKey)) {
                     auto itr = container.find(lastKey);
@@ -172,7 +316,7 @@ namespace collections {
             const KeyTypeIn& endKey, const KeyComparer key_equality = equal_to{})
         {
             if (obj) {
-                object_lock g(obj);
+                object_shared_lock g(obj);
                 auto& container = obj->u_container();
 
                 if (container.empty()) {
@@ -212,7 +356,7 @@ namespace collections {
         template<class KeyFunc>
         static void getNthKey(const T *obj, int32_t keyIdx, KeyFunc keyFunc) {
             if (obj) {
-                object_lock g(obj);
+                object_shared_lock g(obj);
                 auto idx = array_functions::convertReadIndex(obj, keyIdx);
                 if (idx) {
                     int32_t count = obj->u_count();
@@ -0,0 +1,558 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+
+#include <boost/container/small_vector.hpp>
+
+#include "util/spinlock.h"
+
+namespace collections {
+
+    // Associative container with std::map's interface (the part JContainers uses) over an open addressing hash table.
+    //
+    // The entries live in a dense vector. A small map is flat: the vector is sorted, there is no table,
+    // a lookup is a binary search, like boost::container::flat_map's. The map switches to the hashed layout
+    // once it grows past Traits::flat_size or gets modified in its middle while being larger than that -
+    // unless the map only grows at its end and Traits::flat_appends allows to stay flat then (integer keys
+    // set in ascending order, loaded maps)
+    //
+    // In the hashed layout the entries are in no particular order - an erased entry gets replaced by the last one.
+    // Each slot of the table keeps the entry's hash next to the entry's index, so a probe compares keys only
+    // when the hashes match. The table uses linear probing and backward shift deletion, i.e. has no tombstones.
+    //
+    // Iteration follows Traits::less, as std::map's does. The sorted order of the hashed layout is built on the
+    // first iteration after a key has been added, under the container's own lock - readers share the object's lock.
+    // Modifications happen under the object's exclusive lock, so they update the order without that lock
+    //
+    // The first Traits::inline_size entries live inside the container, a map that small allocates nothing
+    //
+    // Traits provide hash(key), equal(key, other), less(key, other), flat_size, flat_appends and inline_size;
+    // hash, equal and less are called with any type the container gets looked up with
+    template<class Key, class T, class Traits>
+    class hashed_map {
+    public:
+        typedef Key key_type;
+        typedef T mapped_type;
+        typedef std::pair<Key, T> value_type;
+        typedef size_t size_type;
+        typedef ptrdiff_t difference_type;
+
+    private:
+
+        enum : uint32_t {
+            no_entry = 0xffffffff,
+            min_table_size = 8,
+        };
+
+        struct slot {
+            uint32_t hash;
+            uint32_t entry;     // no_entry if the slot is free
+        };
+
+        typedef typename std::conditional<Traits::inline_size != 0,
+            boost::container::small_vector<value_type, Traits::inline_size>,
+            std::vector<value_type>
+        >::type entry_vector;
+
+        entry_vector _entries;
+        std::vector<uint32_t> _hashes;  // _hashes[i] - the hash of _entries[i].first, empty if the map is flat
+        std::vector<slot> _table;       // a power of two in size, at most 3/4 full, empty if the map is flat
+
+        // _order[rank] - an entry's index, _ranks[index] - the entry's rank. An erased entry leaves a hole (no_entry)
+        // in _order, the live ranks lie within [_front, _back)
+        mutable std::vector<uint32_t> _order;
+        mutable std::vector<uint32_t> _ranks;
+        mutable uint32_t _front;
+        mutable uint32_t _back;
+        mutable uint32_t _holes;
+        mutable std::atomic<bool> _ordered;
+        mutable util::spinlock _order_lock;
+
+        template<class Map, class Value>
+        class basic_iterator {
+            friend class hashed_map;
+            template<class, class> friend class basic_iterator;
+
+            Map *_map;
+            uint32_t _entry;    // no_entry - the end
+
+        public:
+            typedef std::bidirectional_iterator_tag iterator_category;
+            typedef typename std::remove_const<Value>::type value_type;
+            typedef ptrdiff_t difference_type;
+            typedef Value* pointer;
+            typedef Value& reference;
+
+            basic_iterator() : _map(nullptr), _entry(no_entry) {}
+            basic_iterator(Map *map, uint32_t entry) : _map(map), _entry(entry) {}
+
+            // iterator -> const_iterator
+            template<class OtherMap, class OtherValue>
+            basic_iterator(const basic_iterator<OtherMap, OtherValue>& other) : _map(other._map), _entry(other._entry) {}
+
+            reference operator * () const { return _map->_entries[_entry]; }
+            pointer operator -> () const { return &_map->_entries[_entry]; }
+
+            basic_iterator& operator ++ () {
+                _entry = _map->next_entry(_entry);
+                return *this;
+            }
+            basic_iterator operator ++ (int) {
+                auto copy = *this;
+                ++*this;
+                return copy;
+            }
+            basic_iterator& operator -- () {
+                _entry = _map->previous_entry(_entry);
+                return *this;
+            }
+            basic_iterator operator -- (int) {
+                auto copy = *this;
+                --*this;
+                return copy;
+            }
+
+            template<class OtherMap, class OtherValue>
+            bool operator == (const basic_iterator<OtherMap, OtherValue>& other) const { return _entry == other._entry; }
+            template<class OtherMap, class OtherValue>
+            bool operator != (const basic_iterator<OtherMap, OtherValue>& other) const { return _entry != other._entry; }
+        };
+
+    public:
+
+        typedef basic_iterator<hashed_map, value_type> iterator;
+        typedef basic_iterator<const hashed_map, const value_type> const_iterator;
+        typedef std::reverse_iterator<iterator> reverse_iterator;
+        typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+        hashed_map() : _front(0), _back(0), _holes(0), _ordered(true) {}
+
+        hashed_map(const hashed_map& other)
+            : _entries(other._entries)
+            , _hashes(other._hashes)
+            , _table(other._table)
+            , _front(0), _back(0), _holes(0)
+            , _ordered(false)
+        {}
+
+        hashed_map(hashed_map&& other) : _front(0), _back(0), _holes(0), _ordered(false) {
+            swap(other);
+        }
+
+        hashed_map& operator = (const hashed_map& other) {
+            if (this != &other) {
+                hashed_map copy(other);
+                swap(copy);
+            }
+            return *this;
+        }
+
+        hashed_map& operator = (hashed_map&& other) {
+            if (this != &other) {
+                clear();
+                swap(other);
+            }
+            return *this;
+        }
+
+        void swap(hashed_map& other) {
+            _entries.swap(other._entries);
+            _hashes.swap(other._hashes);
+            _table.swap(other._table);
+            invalidate_order();
+            other.invalidate_order();
+        }
+
+        size_type size() const { return _entries.size(); }
+        bool empty() const { return _entries.empty(); }
+
+        iterator begin() { return iterator(this, first_entry()); }
+        iterator end() { return iterator(this, no_entry); }
+        const_iterator begin() const { return const_iterator(this, first_entry()); }
+        const_iterator end() const { return const_iterator(this, no_entry); }
+        const_iterator cbegin() const { return begin(); }
+        const_iterator cend() const { return end(); }
+
+        reverse_iterator rbegin() { return reverse_iterator(end()); }
+        reverse_iterator rend() { return reverse_iterator(begin()); }
+        const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+        const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+        void reserve(size_type count) {
+            _entries.reserve(count);
+            if (flat() && (count <= Traits::flat_size || Traits::flat_appends)) {
+                return;
+            }
+            if (flat()) {
+                to_hashed();
+            }
+            _hashes.reserve(count);
+            if (table_size_for(count) > _table.size()) {
+                rehash(table_size_for(count));
+            }
+        }
+
+        // the layout, see the class' description
+        bool flat() const { return _table.empty(); }
+
+        // bytes taken from the heap
+        size_t memory_usage() const {
+            const size_t entries = _entries.capacity() > Traits::inline_size ? _entries.capacity() : 0;
+            return entries * sizeof(value_type) + _hashes.capacity() * sizeof(uint32_t) + _table.capacity() * sizeof(slot)
+                + (_order.capacity() + _ranks.capacity()) * sizeof(uint32_t);
+        }
+
+        void clear() {
+            _entries.clear();
+            _hashes.clear();
+            _table.clear();
+            invalidate_order();
+        }
+
+        template<class K>
+        iterator find(const K& key) {
+            return iterator(this, find_entry(key));
+        }
+
+        template<class K>
+        const_iterator find(const K& key) const {
+            return const_iterator(this, find_entry(key));
+        }
+
+        template<class K>
+        size_type count(const K& key) const {
+            return find_entry(key) != no_entry ? 1 : 0;
+        }
+
+        // Key gets constructed of @key only if there was no such key
+        template<class K>
+        T& operator [] (K&& key) {
+            return _entries[emplace_entry(std::forward<K>(key))].second;
+        }
+
+        // no effect if the key is present already
+        std::pair<iterator, bool> insert(const value_type& value) {
+            const size_type count = size();
+            const uint32_t entry = emplace_entry(value.first, value.second);
+            return std::make_pair(iterator(this, entry), size() != count);
+        }
+
+        std::pair<iterator, bool> insert(value_type&& value) {
+            const size_type count = size();
+            const uint32_t entry = emplace_entry(std::move(value.first), std::move(value.second));
+            return std::make_pair(iterator(this, entry), size() != count);
+        }
+
+        template<class InputIterator>
+        void insert(InputIterator first, InputIterator last) {
+            for (; first != last; ++first) {
+                insert(*first);
+            }
+        }
+
+        std::pair<iterator, bool> emplace(value_type&& value) {
+            return insert(std::move(value));
+        }
+
+        // returns the iterator which followed the erased one
+        iterator erase(const_iterator position) {
+            const uint32_t entry = position._entry;
+            uint32_t next = next_entry(entry);
+            if (flat() && flat_erasable(entry)) {
+                _entries.erase(_entries.begin() + entry);
+                return iterator(this, next != no_entry ? entry : no_entry);
+            }
+            const uint32_t moved = erase_entry(entry);
+            if (moved != no_entry && next == moved) {
+                next = entry; // the last entry has been moved into the erased one's place
+            }
+            return iterator(this, next);
+        }
+
+        iterator erase(iterator position) {
+            return erase(const_iterator(position));
+        }
+
+        // erase which doesn't look for the following entry, i.e. doesn't sort the keys if they aren't sorted yet
+        void drop(const_iterator position) {
+            erase_entry(position._entry);
+        }
+
+        template<class K>
+        size_type erase(const K& key) {
+            const uint32_t entry = find_entry(key);
+            if (entry == no_entry) {
+                return 0;
+            }
+            erase_entry(entry);
+            return 1;
+        }
+
+    private:
+
+        static size_t table_size_for(size_type count) {
+            size_t table_size = min_table_size;
+            while (table_size * 3 < count * 4) {
+                table_size *= 2;
+            }
+            return table_size;
+        }
+
+        size_t mask() const { return _table.size() - 1; }
+
+        template<class K>
+        uint32_t flat_lower_bound(const K& key) const {
+            auto itr = std::lower_bound(_entries.begin(), _entries.end(), key, [](const value_type& entry, const K& key) {
+                return Traits::less(entry.first, key);
+            });
+            return uint32_t(itr - _entries.begin());
+        }
+
+        template<class K>
+        uint32_t find_entry(const K& key) const {
+            if (flat()) {
+                const uint32_t pos = flat_lower_bound(key);
+                return pos < _entries.size() && Traits::equal(_entries[pos].first, key) ? pos : no_entry;
+            }
+            return find_hashed(key, Traits::hash(key));
+        }
+
+        template<class K>
+        uint32_t find_hashed(const K& key, uint32_t hash) const {
+            for (size_t pos = hash & mask(); ; pos = (pos + 1) & mask()) {
+                const slot& s = _table[pos];
+                if (s.entry == no_entry) {
+                    return no_entry;
+                }
+                if (s.hash == hash && Traits::equal(_entries[s.entry].first, key)) {
+                    return s.entry;
+                }
+            }
+        }
+
+        // the position of the slot which points to @entry
+        size_t slot_of(uint32_t entry) const {
+            size_t pos = _hashes[entry] & mask();
+            while (_table[pos].entry != entry) {
+                pos = (pos + 1) & mask();
+            }
+            return pos;
+        }
+
+        void place(uint32_t hash, uint32_t entry) {
+            size_t pos = hash & mask();
+            while (_table[pos].entry != no_entry) {
+                pos = (pos + 1) & mask();
+            }
+            _table[pos] = slot{ hash, entry };
+        }
+
+        void rehash(size_t table_size) {
+            _table.assign(table_size, slot{ 0, no_entry });
+            for (uint32_t i = 0, count = uint32_t(_entries.size()); i < count; ++i) {
+                place(_hashes[i], i);
+            }
+        }
+
+        // the index of the entry with @key, a new entry with T constructed of @args if there was no such key
+        template<class K, class ...Args>
+        uint32_t emplace_entry(K&& key, Args&&... args) {
+            if (flat()) {
+                const uint32_t pos = flat_lower_bound(key);
+                if (pos < _entries.size() && Traits::equal(_entries[pos].first, key)) {
+                    return pos;
+                }
+                if (_entries.size() < Traits::flat_size || (Traits::flat_appends && pos == _entries.size())) {
+                    _entries.emplace(_entries.begin() + pos, std::piecewise_construct,
+                        std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+                    return pos;
+                }
+                to_hashed();
+            }
+
+            const uint32_t hash = Traits::hash(key);
+            const uint32_t existing = find_hashed(key, hash);
+            if (existing != no_entry) {
+                return existing;
+            }
+
+            if ((_entries.size() + 1) * 4 > _table.size() * 3) {
+                rehash((std::max)(size_t(min_table_size), _table.size() * 2));
+            }
+
+            const uint32_t entry = uint32_t(_entries.size());
+            _entries.emplace_back(std::piecewise_construct,
+                std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+            _hashes.push_back(hash);
+            place(hash, entry);
+            invalidate_order();
+            return entry;
+        }
+
+        // a flat map stays flat while it's small or gets modified at its end
+        bool flat_erasable(uint32_t entry) const {
+            return _entries.size() <= Traits::flat_size || entry + 1 == _entries.size();
+        }
+
+        void to_hashed() {
+            _hashes.resize(_entries.size());
+            for (size_t i = 0, count = _entries.size(); i < count; ++i) {
+                _hashes[i] = Traits::hash(_entries[i].first);
+            }
+            rehash(table_size_for(_entries.size() + 1));
+            invalidate_order();
+        }
+
+        // returns the former index of the entry which took the erased one's place, no_entry if none
+        // (or if the map is flat - the entries which followed the erased one shift back then)
+        uint32_t erase_entry(uint32_t entry) {
+            if (flat()) {
+                if (flat_erasable(entry)) {
+                    _entries.erase(_entries.begin() + entry);
+                    return no_entry;
+                }
+                to_hashed();
+            }
+
+            // backward shift: the slots which follow the freed one move closer to their home positions
+            size_t hole = slot_of(entry);
+            for (size_t next = (hole + 1) & mask(); _table[next].entry != no_entry; next = (next + 1) & mask()) {
+                const size_t home = _table[next].hash & mask();
+                // the slot can't move before its home position
+                if (((next - home) & mask()) >= ((next - hole) & mask())) {
+                    _table[hole] = _table[next];
+                    hole = next;
+                }
+            }
+            _table[hole].entry = no_entry;
+
+            const uint32_t last = uint32_t(_entries.size() - 1);
+            if (_ordered.load(std::memory_order_relaxed)) {
+                // cheaper than sorting again: erasing while iterating is common
+                u_erase_from_order(entry, last);
+            }
+
+            uint32_t moved = no_entry;
+            if (entry != last) {
+                _table[slot_of(last)].entry = entry;
+                _entries[entry] = std::move(_entries[last]);
+                _hashes[entry] = _hashes[last];
+                moved = last;
+            }
+            _entries.pop_back();
+            _hashes.pop_back();
+            if (_entries.empty()) {
+                clear(); // back to the flat layout
+            }
+            return moved;
+        }
+
+        // the order stays valid after @entry gets erased and @last moves into its place
+        void u_erase_from_order(uint32_t entry, uint32_t last) {
+            _order[_ranks[entry]] = no_entry;
+            ++_holes;
+            if (entry != last) {
+                const uint32_t last_rank = _ranks[last];
+                _order[last_rank] = entry;
+                _ranks[entry] = last_rank;
+            }
+            _ranks.pop_back();
+
+            while (_front < _back && _order[_front] == no_entry) {
+                ++_front;
+            }
+            while (_back > _front && _order[_back - 1] == no_entry) {
+                --_back;
+            }
+
+            // iteration skips at most as many holes as there are entries
+            if (_holes > _ranks.size()) {
+                _order.erase(std::remove(_order.begin(), _order.end(), uint32_t(no_entry)), _order.end());
+                for (uint32_t rank = 0, count = uint32_t(_order.size()); rank < count; ++rank) {
+                    _ranks[_order[rank]] = rank;
+                }
+                _front = 0;
+                _back = uint32_t(_order.size());
+                _holes = 0;
+            }
+        }
+
+        void invalidate_order() {
+            _ordered.store(false, std::memory_order_relaxed);
+        }
+
+        void ensure_order() const {
+            if (_ordered.load(std::memory_order_acquire)) {
+                return;
+            }
+
+            util::spinlock::guard g(_order_lock);
+            if (_ordered.load(std::memory_order_relaxed)) {
+                return;
+            }
+
+            const uint32_t count = uint32_t(_entries.size());
+            _order.resize(count);
+            std::iota(_order.begin(), _order.end(), 0u);
+            std::sort(_order.begin(), _order.end(), [this](uint32_t left, uint32_t right) {
+                return Traits::less(_entries[left].first, _entries[right].first);
+            });
+
+            _ranks.resize(count);
+            for (uint32_t rank = 0; rank < count; ++rank) {
+                _ranks[_order[rank]] = rank;
+            }
+            _front = 0;
+            _back = count;
+            _holes = 0;
+            _ordered.store(true, std::memory_order_release);
+        }
+
+        uint32_t first_entry() const {
+            if (_entries.empty()) {
+                return no_entry;
+            }
+            if (flat()) {
+                return 0;
+            }
+            ensure_order();
+            return _order[_front];
+        }
+
+        uint32_t next_entry(uint32_t entry) const {
+            if (flat()) {
+                return entry + 1 < _entries.size() ? entry + 1 : no_entry;
+            }
+            ensure_order();
+            uint32_t rank = _ranks[entry] + 1;
+            while (rank < _back && _order[rank] == no_entry) {
+                ++rank;
+            }
+            return rank < _back ? _order[rank] : no_entry;
+        }
+
+        // the last entry if @entry is no_entry (the end)
+        uint32_t previous_entry(uint32_t entry) const {
+            if (flat()) {
+                const uint32_t index = entry != no_entry ? entry : uint32_t(_entries.size());
+                return index > 0 ? index - 1 : no_entry;
+            }
+            ensure_order();
+            uint32_t rank = entry != no_entry ? _ranks[entry] : _back;
+            while (rank > _front) {
+                if (_order[--rank] != no_entry) {
+                    return _order[rank];
+                }
+            }
+            return no_entry;
+        }
+    };
+}
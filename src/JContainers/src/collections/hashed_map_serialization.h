@@ -0,0 +1,50 @@
+#pragma once
+
+#include <boost/archive/basic_archive.hpp>
+#include <boost/serialization/utility.hpp>
+#include <boost/serialization/collections_save_imp.hpp>
+#include <boost/serialization/detail/stack_constructor.hpp>
+#include <boost/serialization/split_free.hpp>
+
+#include "collections/hashed_map.h"
+
+// hashed_map is saved the way std::map is: the entries in the sorted order, pair<Key, T> has the same layout as pair<const Key, T>.
+// Save files written with std::map based containers load into hashed_map and vice versa
+
+namespace boost {
+    namespace serialization {
+
+        template<class Archive, class Key, class T, class Traits>
+        void save(Archive & ar, const collections::hashed_map<Key, T, Traits>& cnt, const unsigned int) {
+            stl::save_collection<Archive, collections::hashed_map<Key, T, Traits> >(ar, cnt);
+        }
+
+        template<class Archive, class Key, class T, class Traits>
+        void load(Archive & ar, collections::hashed_map<Key, T, Traits>& cnt, const unsigned int) {
+            typedef typename collections::hashed_map<Key, T, Traits>::value_type value_type;
+
+            cnt.clear();
+
+            const boost::archive::library_version_type library_version(ar.get_library_version());
+            item_version_type item_version(0);
+            collection_size_type count;
+            ar >> BOOST_SERIALIZATION_NVP(count);
+            if (boost::archive::library_version_type(3) < library_version) {
+                ar >> BOOST_SERIALIZATION_NVP(item_version);
+            }
+
+            cnt.reserve(count);
+            while (count-- > 0) {
+                detail::stack_construct<Archive, value_type> t(ar, item_version);
+                ar >> boost::serialization::make_nvp("item", t.reference());
+                auto result = cnt.insert(std::move(t.reference()));
+                ar.reset_object_address(&result.first->second, &t.reference().second);
+            }
+        }
+
+        template<class Archive, class Key, class T, class Traits>
+        void serialize(Archive & ar, collections::hashed_map<Key, T, Traits>& cnt, const unsigned int version) {
+            split_free(ar, cnt, version);
+        }
+    }
+}
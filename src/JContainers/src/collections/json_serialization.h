@@ -430,7 +430,7 @@ namespace collections {
                 }
                 void operator () (const map& cnt) {
                     for (auto& pair : cnt.u_container()) {
-                        self->fill_key_info(pair.second, cnt, pair.first);
+                        self->fill_key_info(pair.second, cnt, pair.first.str());
                         json_object_set_new(object, pair.first.c_str(), self->create_value(pair.second));
                     }
                 }
@@ -192,7 +192,7 @@ namespace lua { namespace api {
 
     cexport JCToLuaValue JArray_getValue(array* obj, index key) {
         JCToLuaValue v(JCToLuaValue_None());
-        array_functions::doReadOp(obj, key, [=, &v](index idx) {
+        array_functions::doSharedReadOp(obj, key, [=, &v](index idx) {
             v = JCToLuaValue_fromItem(obj->u_container()[idx]);
         });
         //std::cout << "value returned: " << JCValue_toString(v) << std::endl;
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <boost/noncopyable.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/level.hpp>
+#include <boost/serialization/tracking.hpp>
+
+#include "util/spinlock.h"
+#include "util/singleton.h"
+#include "util/istring.h"
+
+namespace collections {
+
+    // A JMap key - a reference to a string interned in a process-wide table, so the maps which share
+    // a key vocabulary share the key strings, and a map entry keeps a pointer instead of a std::string.
+    //
+    // Every spelling of a key is interned as is (the maps keep the spelling they've been given),
+    // and points to the node of its lower-case spelling. Keys equal case-insensitively have the same
+    // lower-case node, so the case-insensitive comparison of two keys is a pointer comparison.
+    // The empty string is the null node
+    class map_key {
+    public:
+
+        struct node : boost::noncopyable {
+            std::atomic<uint32_t> refs;
+            const uint32_t hash;        // util::case_folded_hash of the text
+            node * const folded;        // the lower-case spelling's node, retained by this node unless it's this node
+            const std::string text;
+
+            node(uint32_t hash_, node *folded_, std::string&& text_)
+                : refs(1), hash(hash_), folded(folded_ ? folded_ : this), text(std::move(text_)) {}
+        };
+
+        class pool : boost::noncopyable {
+            util::spinlock _lock;
+            std::unordered_multimap<uint32_t, node *> _nodes;   // by the case-folded hash
+
+        public:
+
+            static pool& instance() {
+                // never destroyed: the maps destroyed at exit still release their keys
+                static util::singleton<pool, false> si{ []() { return new pool(); } };
+                return si.get();
+            }
+
+            // retained node of the @str
+            node* intern(const char *str, size_t length) {
+                if (length == 0) {
+                    return nullptr;
+                }
+                const uint32_t hash = util::case_folded_hash(str, length);
+
+                util::spinlock::guard g(_lock);
+                if (node *existing = u_find(hash, str, length)) {
+                    existing->refs.fetch_add(1, std::memory_order_relaxed);
+                    return existing;
+                }
+
+                std::string lower(str, length);
+                for (auto& c : lower) {
+                    c = char(tolower(uint8_t(c)));
+                }
+
+                node *folded = nullptr;
+                if (lower.compare(0, length, str, length) != 0) {
+                    folded = u_find(hash, lower.c_str(), length);
+                    if (folded) {
+                        folded->refs.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    else {
+                        folded = u_insert(hash, nullptr, std::move(lower));
+                    }
+                    return u_insert(hash, folded, std::string(str, length));
+                }
+                return u_insert(hash, nullptr, std::move(lower));
+            }
+
+            void retain(node *n) {
+                n->refs.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            // a node can be found by 'intern' only while its count is positive, so the count reaches zero
+            // only under the lock
+            void release(node *n) {
+                uint32_t refs = n->refs.load(std::memory_order_relaxed);
+                while (refs > 1) {
+                    if (n->refs.compare_exchange_weak(refs, refs - 1, std::memory_order_release, std::memory_order_relaxed)) {
+                        return;
+                    }
+                }
+
+                util::spinlock::guard g(_lock);
+                if (n->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    node *folded = n->folded;
+                    u_erase(n);
+                    if (folded != n && folded->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                        u_erase(folded);
+                    }
+                }
+            }
+
+            size_t size() {
+                util::spinlock::guard g(_lock);
+                return _nodes.size();
+            }
+
+        private:
+
+            node* u_find(uint32_t hash, const char *str, size_t length) const {
+                auto range = _nodes.equal_range(hash);
+                for (auto itr = range.first; itr != range.second; ++itr) {
+                    const std::string& text = itr->second->text;
+                    if (text.size() == length && memcmp(text.data(), str, length) == 0) {
+                        return itr->second;
+                    }
+                }
+                return nullptr;
+            }
+
+            node* u_insert(uint32_t hash, node *folded, std::string&& text) {
+                node *n = new node(hash, folded, std::move(text));
+                _nodes.emplace(hash, n);
+                return n;
+            }
+
+            void u_erase(node *n) {
+                auto range = _nodes.equal_range(n->hash);
+                for (auto itr = range.first; itr != range.second; ++itr) {
+                    if (itr->second == n) {
+                        _nodes.erase(itr);
+                        break;
+                    }
+                }
+                delete n;
+            }
+        };
+
+    private:
+
+        node *_node;
+
+        static const std::string& empty_string() {
+            static const std::string empty;
+            return empty;
+        }
+
+    public:
+
+        map_key() : _node(nullptr) {}
+
+        explicit map_key(const char *str) : _node(pool::instance().intern(str, strlen(str))) {}
+        explicit map_key(const std::string& str) : _node(pool::instance().intern(str.c_str(), str.size())) {}
+
+        map_key(const map_key& other) : _node(other._node) {
+            if (_node) {
+                pool::instance().retain(_node);
+            }
+        }
+
+        map_key(map_key&& other) : _node(other._node) {
+            other._node = nullptr;
+        }
+
+        map_key& operator = (const map_key& other) {
+            map_key(other).swap(*this);
+            return *this;
+        }
+
+        map_key& operator = (map_key&& other) {
+            map_key(std::move(other)).swap(*this);
+            return *this;
+        }
+
+        ~map_key() {
+            if (_node) {
+                pool::instance().release(_node);
+            }
+        }
+
+        void swap(map_key& other) {
+            std::swap(_node, other._node);
+        }
+
+        const std::string& str() const { return _node ? _node->text : empty_string(); }
+        const char* c_str() const { return str().c_str(); }
+        size_t size() const { return str().size(); }
+        bool empty() const { return _node == nullptr; }
+
+        operator const std::string& () const { return str(); }
+
+        uint32_t hash() const { return _node ? _node->hash : util::case_folded_hash("", 0); }
+
+        // case-insensitive equality
+        bool same_key(const map_key& other) const {
+            return (_node ? _node->folded : nullptr) == (other._node ? other._node->folded : nullptr);
+        }
+
+        // case-sensitive, as std::string's
+        friend bool operator == (const map_key& l, const map_key& r) { return l._node == r._node; }
+        friend bool operator != (const map_key& l, const map_key& r) { return l._node != r._node; }
+        friend bool operator == (const map_key& l, const std::string& r) { return l.str() == r; }
+        friend bool operator == (const std::string& l, const map_key& r) { return l == r.str(); }
+        friend bool operator != (const map_key& l, const std::string& r) { return l.str() != r; }
+        friend bool operator != (const std::string& l, const map_key& r) { return l != r.str(); }
+        friend bool operator == (const map_key& l, const char *r) { return l.str() == r; }
+        friend bool operator != (const map_key& l, const char *r) { return l.str() != r; }
+
+        // boost.serialization: saved as std::string
+        template<class Archive>
+        void save(Archive& ar, const unsigned int) const {
+            ar << str();
+        }
+
+        template<class Archive>
+        void load(Archive& ar, const unsigned int) {
+            std::string text;
+            ar >> text;
+            map_key(text).swap(*this);
+        }
+
+        template<class Archive>
+        void serialize(Archive& ar, const unsigned int version) {
+            boost::serialization::split_member(ar, *this, version);
+        }
+    };
+}
+
+// no class information, no tracking - a key is saved exactly as std::string is
+BOOST_CLASS_IMPLEMENTATION(collections::map_key, boost::serialization::object_serializable)
+BOOST_CLASS_TRACKING(collections::map_key, boost::serialization::track_never)
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <boost/archive/basic_archive.hpp>
+#include <boost/container/small_vector.hpp>
+#include <boost/serialization/collections_save_imp.hpp>
+#include <boost/serialization/collections_load_imp.hpp>
+#include <boost/serialization/split_free.hpp>
+
+// boost::container::small_vector is saved the way std::vector of a non-bitwise type is,
+// so JArrays load from the save files written before the arrays got their inline storage
+
+namespace boost {
+    namespace serialization {
+
+        template<class Archive, class T, std::size_t N>
+        void save(Archive & ar, const boost::container::small_vector<T, N>& cnt, const unsigned int) {
+            stl::save_collection<Archive, boost::container::small_vector<T, N> >(ar, cnt);
+        }
+
+        template<class Archive, class T, std::size_t N>
+        void load(Archive & ar, boost::container::small_vector<T, N>& cnt, const unsigned int) {
+            const boost::archive::library_version_type library_version(ar.get_library_version());
+            item_version_type item_version(0);
+            collection_size_type count;
+            ar >> BOOST_SERIALIZATION_NVP(count);
+            if (boost::archive::library_version_type(3) < library_version) {
+                ar >> BOOST_SERIALIZATION_NVP(item_version);
+            }
+            cnt.reserve(count);
+            stl::collection_load_impl(ar, cnt, count, item_version);
+        }
+
+        template<class Archive, class T, std::size_t N>
+        void serialize(Archive & ar, boost::container::small_vector<T, N>& cnt, const unsigned int version) {
+            split_free(ar, cnt, version);
+        }
+    }
+}
@@ -249,6 +249,9 @@ namespace domain_master {
 
         }
 
+        // Runs on the thread of SKSE's save callback, not on the worker pool: the stream belongs to the callback
+        // and must be complete once it returns, and the stopped activity keeps the object graph intact for the
+        // whole walk of the archive. A pool job would only add a hand-off the calling thread waits for
         auto write_to_stream(master& self, std::ostream& stream) -> void {
             stream.flags(stream.flags() | std::ios::binary);
 
@@ -1,58 +1,29 @@
 #pragma once
 
 #include <atomic>
+#include <array>
 #include <deque>
 #include <boost\serialization\version.hpp>
 #include <boost\asio\io_service.hpp>
 #include <boost\asio\deadline_timer.hpp>
-#include "common\IThread.h"
 #include "util\util.h"
-#include "util\singleton.h"
+#include "util\worker_pool.h"
 
 namespace collections {
 
-
-    namespace detail {
-
-#   define WINE_SUPPORT 1
-
-        struct background_worker {
-            boost::asio::io_service _io;
-            boost::asio::io_service::work _work;
-#   if WINE_SUPPORT
-            IThread _thread;
-#   else
-            std::thread _thread;
-#   endif
-
-            background_worker() : _io(), _work(_io) {
-#   if WINE_SUPPORT
-                using io_ptr_type = decltype(_io);
-                _thread.Start([](void *io_ptr) { reinterpret_cast<io_ptr_type*>(io_ptr)->run(); }, &_io);
-#   else
-                _thread = std::thread([&]() { _io.run(); });
-#   endif
-            }
-
-            ~background_worker() {
-#   if WINE_SUPPORT
-                _thread.Stop();
-                WaitForSingleObject(_thread.GetHandle(), INFINITE);
-#   else
-                if (_thread.joinable()) {
-                    _thread.join();
-                }
-#   endif
-            }
-        };
-
-        util::singleton<background_worker> g_background_worker{ [](){ return new background_worker(); } };
-    }
-
-
     class object_registry;
 
     // The purpose of autorelease_queue (aqueue) is to temporarily own an object and increase an object's lifetime
+    //
+    // Queued objects are spread over a timer wheel - a ring of buckets, one bucket per tick. An object sits
+    // in the bucket of the tick its lifetime expires at, so a tick only touches the objects expiring right now.
+    // Prolonging the lifetime of an already queued object just updates its push time, the entry
+    // gets moved forward once its (now outdated) bucket expires. An object knows its bucket and its index there,
+    // so zero_lifetime moves it at once.
+    //
+    // New objects don't go into the wheel directly: prolong_lifetime puts them into one of the insertion buffers,
+    // each thread sticks to its own buffer. The tick moves the buffered objects into the wheel, so threads which
+    // create objects never wait for each other or for the wheel
     class autorelease_queue : boost::noncopyable {
     public:
         typedef std::lock_guard<bshared_mutex> lock;
@@ -69,20 +40,39 @@ namespace collections {
         };
 
         typedef boost::intrusive_ptr_jc<object_base, object_lifetime_policy> queue_object_ref;
+        // flat queue representation, the one that gets serialized
         typedef std::deque<queue_object_ref> queue;
+        typedef std::vector<queue_object_ref> bucket;
+
+        enum : size_t {
+            wheel_size = 8, // amount of buckets, a power of two that is greater than obj_lifeInTicks
+            insertion_buffer_count = 16,
+        };
 
     private:
 
+        struct insertion_buffer {
+            counted_spinlock lock;
+            bucket objects;
+            char _padding[64]; // keeps the locks of neighbour buffers off the same cache line
+        };
+
         object_registry& _registry;
-        queue _queue;
-        time_point _tickCounter;
-        spinlock _queue_mutex;
+        std::array<bucket, wheel_size> _wheel;
+        size_t _count;
+        std::atomic<time_point> _tickCounter;
+        counted_spinlock _queue_mutex;
+
+        std::array<insertion_buffer, insertion_buffer_count> _buffers;
+        std::atomic<size_t> _buffered_count;
         
         boost::asio::deadline_timer _timer;
         std::mutex _timer_mutex;
         bool _timer_stopped = true;
-        // reusable array for temp objects
+        // reusable arrays for temp objects
         std::vector<queue_object_ref> _toRelease;
+        bucket _expiring;
+        bucket _draining;
 
     public:
 
@@ -90,7 +80,14 @@ namespace collections {
             stop();
             
             _tickCounter = 0;
-            _queue.clear();
+            for (auto& bucket : _wheel) {
+                bucket.clear();
+            }
+            for (auto& buffer : _buffers) {
+                buffer.objects.clear();
+            }
+            _count = 0;
+            _buffered_count = 0;
             _toRelease.clear();
         }
 
@@ -100,27 +97,37 @@ namespace collections {
         template<class Archive>
         void save(Archive & ar, const unsigned int version) const {
             jc_assert(version == 2);
-            ar & _tickCounter;
-            ar & _queue;
+            time_point tick_counter = _tickCounter.load(std::memory_order_relaxed);
+            ar & tick_counter;
+
+            const queue flat = u_flatten();
+            ar & flat;
         }
 
         template<class Archive>
         void load(Archive & ar, const unsigned int version) {
-            ar & _tickCounter;
+            time_point tick_counter = 0;
+            ar & tick_counter;
+            _tickCounter.store(tick_counter, std::memory_order_relaxed);
 
             switch (version) {
-            case 2:
-                ar & _queue;
+            case 2: {
+                queue flat;
+                ar & flat;
+                for (auto& ref : flat) {
+                    u_insert(std::move(ref));
+                }
                 break;
+            }
             case 1: {
                 typedef std::deque<std::pair<queue_object_ref, time_point> > queue_old;
                 queue_old old;
                 ar & old;
-                for (const auto& pair : old) {
+                for (auto& pair : old) {
                     auto object = pair.first.get();
                     if (object) {
-                        _queue.push_back(std::move(pair.first));
                         object->_aqueue_push_time = pair.second;
+                        u_insert(std::move(pair.first));
                     }
                 }
                 break;
@@ -132,8 +139,8 @@ namespace collections {
                 for (const auto& pair : old) {
                     auto object = _registry.u_getObject(pair.first);
                     if (object) {
-                        _queue.push_back(object);
                         object->_aqueue_push_time = pair.second;
+                        u_insert(object);
                     }
                 }
                 break;
@@ -146,9 +153,10 @@ namespace collections {
 
         explicit autorelease_queue(object_registry& registry) 
             : _registry(registry)
-            , _queue()
+            , _count(0)
             , _tickCounter(0)
-            , _timer(detail::g_background_worker.get()._io)
+            , _buffered_count(0)
+            , _timer(util::background_workers().io_service())
         {
             start();
             //jc_debug("aqueue created")
@@ -158,33 +166,56 @@ namespace collections {
         void prolong_lifetime(object_base& object, bool isPublic) {
             //jc_debug("aqueue: added id - %u as %s", object._uid(), isPublic ? "public" : "private");
 
-            spinlock::guard g(_queue_mutex);
-            object._aqueue_push_time = isPublic ? _tickCounter : time_subtract(_tickCounter, obj_lifeInTicks);
-            if (!object.is_in_aqueue()) {
-                _queue.push_back(&object);
+            const time_point now = _tickCounter.load(std::memory_order_acquire);
+            object._aqueue_push_time.store(isPublic ? now : time_subtract(now, obj_lifeInTicks), std::memory_order_relaxed);
+
+            // of the threads prolonging the same object at once, only one gets to queue it
+            if (object._aqueue_try_retain()) {
+                auto& buffer = _buffers[this_thread_buffer()];
+                counted_spinlock::guard g(buffer.lock);
+                buffer.objects.emplace_back(&object, false);
+                _buffered_count.fetch_add(1, std::memory_order_relaxed);
             }
         }
 
+        // the object gets released at the bucket's turn it currently sits in, which never happens
+        // later than the lifetime it was given before
         void not_prolong_lifetime(object_base& object) {
             if (object.is_in_aqueue()) {
                 //jc_debug("aqueue: removed id - %u", object._uid());
-                spinlock::guard g(_queue_mutex);
-                object._aqueue_push_time = time_subtract(_tickCounter, obj_lifeInTicks);
+                object._aqueue_push_time.store(time_subtract(_tickCounter.load(std::memory_order_acquire), obj_lifeInTicks),
+                    std::memory_order_relaxed);
+            }
+        }
+
+        // same as above, but also moves the object into the bucket of the next tick
+        void zero_lifetime(object_base& object) {
+            if (object.is_in_aqueue()) {
+                counted_spinlock::guard g(_queue_mutex);
+                object._aqueue_push_time.store(time_subtract(_tickCounter.load(std::memory_order_relaxed), obj_lifeInTicks),
+                    std::memory_order_relaxed);
+                // a buffered object gets into the due bucket right away
+                u_drain_buffers();
+                u_move_to_due_bucket(object);
             }
         }
 
         // amount of objects in queue
         size_t count() {
-            spinlock::guard g(_queue_mutex);
+            counted_spinlock::guard g(_queue_mutex);
             return u_count();
         }
 
-        queue& u_queue() {
-            return _queue;
+        size_t u_count() const {
+            return _count + _buffered_count.load(std::memory_order_relaxed);
         }
 
-        size_t u_count() const {
-            return _queue.size();
+        util::lock_contention lock_contention() const {
+            auto contention = _queue_mutex.contention();
+            for (auto& buffer : _buffers) {
+                contention += buffer.lock.contention();
+            }
+            return contention;
         }
 
         // starts asynchronouos aqueue run, asynchronouosly releases objects when their time comes, starts timers, 
@@ -207,8 +238,15 @@ namespace collections {
         }
 
         void u_nullify() {
-            for (auto &ref : _queue) {
-                ref.jc_nullify();
+            for (auto& bucket : _wheel) {
+                for (auto &ref : bucket) {
+                    ref.jc_nullify();
+                }
+            }
+            for (auto& buffer : _buffers) {
+                for (auto &ref : buffer.objects) {
+                    ref.jc_nullify();
+                }
             }
         }
 
@@ -258,15 +296,99 @@ namespace collections {
             obj_lifeInTicks = obj_lifetime / tick_duration, // object's lifetime described in amount-of-ticks
         };
 
+        static_assert(obj_lifeInTicks < wheel_size && (wheel_size & (wheel_size - 1)) == 0,
+            "the wheel must cover an object's lifetime");
+
     private:
 
+        // the tick at which the lifetime of an object pushed at @push_time expires,
+        // or the current tick, if the lifetime has expired already
+        time_point u_due_tick(time_point push_time) const {
+            auto diff = time_subtract(_tickCounter, push_time) + 1; // +1 because 0,1,2,3,4,5 is 6 ticks
+            return diff >= obj_lifeInTicks ? _tickCounter : time_add(push_time, obj_lifeInTicks - 1);
+        }
+
+        // threads get their buffers in turn
+        static size_t this_thread_buffer() {
+            static std::atomic<size_t> next_buffer{ 0 };
+            static thread_local size_t buffer = next_buffer.fetch_add(1, std::memory_order_relaxed) % insertion_buffer_count;
+            return buffer;
+        }
+
+        static uint8_t bucket_index(time_point tick) {
+            return uint8_t(tick & (wheel_size - 1));
+        }
+
+        void u_insert(queue_object_ref&& ref) {
+            auto idx = bucket_index(u_due_tick(ref->_aqueue_push_time.load(std::memory_order_relaxed)));
+            auto& to = _wheel[idx];
+            ref->_aqueue_bucket = idx;
+            ref->_aqueue_position = static_cast<uint32_t>(to.size());
+            to.push_back(std::move(ref));
+            ++_count;
+        }
+
+        void u_move_to_due_bucket(object_base& object) {
+            auto& from = _wheel[object._aqueue_bucket];
+            if (bucket_index(u_due_tick(object._aqueue_push_time.load(std::memory_order_relaxed))) == object._aqueue_bucket) {
+                return;
+            }
+
+            // the tick may have just taken the object out of the wheel to release it
+            const uint32_t position = object._aqueue_position;
+            if (position >= from.size() || from[position].get() != &object) {
+                return;
+            }
+
+            // the last object of the bucket takes the place
+            queue_object_ref ref = std::move(from[position]);
+            if (position + 1 != from.size()) {
+                from[position] = std::move(from.back());
+                from[position]->_aqueue_position = position;
+            }
+            from.pop_back();
+            --_count;
+            u_insert(std::move(ref));
+        }
+
+        // moves the objects of the insertion buffers into the wheel
+        void u_drain_buffers() {
+            for (auto& buffer : _buffers) {
+                {
+                    counted_spinlock::guard g(buffer.lock);
+                    if (buffer.objects.empty()) {
+                        continue;
+                    }
+                    _draining.swap(buffer.objects);
+                    _buffered_count.fetch_sub(_draining.size(), std::memory_order_relaxed);
+                }
+
+                for (auto& ref : _draining) {
+                    u_insert(std::move(ref));
+                }
+                _draining.clear();
+            }
+        }
+
+        queue u_flatten() const {
+            queue flat;
+            for (auto& bucket : _wheel) {
+                flat.insert(flat.end(), bucket.begin(), bucket.end());
+            }
+            for (auto& buffer : _buffers) {
+                flat.insert(flat.end(), buffer.objects.begin(), buffer.objects.end());
+            }
+            return flat;
+        }
+
         void u_startTimer() {
 
             boost::system::error_code code;
             _timer.expires_from_now (boost::posix_time::seconds (int (tick_duration)), code);
             assert(!code);
 
-            _timer.async_wait([this](const boost::system::error_code& error) {
+            // ticks never overlap with garbage collection slices
+            _timer.async_wait(util::background_workers().serial().wrap([this](const boost::system::error_code& error) {
                 if (error) {// !e means error or cancel, or unsuccessful completion
                     return;
                 }
@@ -276,28 +398,39 @@ namespace collections {
                     this->tick();
                     this->u_startTimer();
 				}
-            });
+            }));
         }
 
+    public:
+
+        // exposed for testing purposes only, normally invoked by the timer
         void tick() {
             {
-                spinlock::guard g(_queue_mutex);
-                _queue.erase(
-                    std::remove_if(_queue.begin(), _queue.end(), [&](const queue_object_ref& ref) {
-                        jc_assert(ref.get());
-                        auto diff = time_subtract(_tickCounter, ref->_aqueue_push_time) + 1; // +1 because 0,1,2,3,4,5 is 6 ticks
-                        bool release = diff >= obj_lifeInTicks;
-                        //jc_debug("id - %u diff - %u, rc - %u", ref->_uid(), diff, ref->refCount());
-
-                        // just move out object reference to release it later
-                        if (release)
-                            _toRelease.push_back(std::move(ref));
-                        return release;
-                    }),
-                    _queue.end());
+                counted_spinlock::guard g(_queue_mutex);
+
+                u_drain_buffers();
+
+                const time_point now = _tickCounter.load(std::memory_order_relaxed);
+                _expiring.swap(_wheel[bucket_index(now)]);
+                _count -= _expiring.size();
+
+                for (auto& ref : _expiring) {
+                    jc_assert(ref.get());
+                    auto diff = time_subtract(now, ref->_aqueue_push_time.load(std::memory_order_relaxed)) + 1; // +1 because 0,1,2,3,4,5 is 6 ticks
+                    //jc_debug("id - %u diff - %u, rc - %u", ref->_uid(), diff, ref->refCount());
+
+                    // just move out object reference to release it later
+                    if (diff >= obj_lifeInTicks) {
+                        _toRelease.push_back(std::move(ref));
+                    }
+                    else { // the lifetime has been prolonged since the object got into the bucket
+                        u_insert(std::move(ref));
+                    }
+                }
+                _expiring.clear();
 
                 // Increments tick counter, _tickCounter += 1
-                _tickCounter = time_add(_tickCounter, one_tick);
+                _tickCounter.store(time_add(now, one_tick), std::memory_order_release);
             }
 
             //jc_debug("%u objects released", _toRelease.size());
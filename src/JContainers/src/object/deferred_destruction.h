@@ -0,0 +1,103 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <boost/noncopyable.hpp>
+
+#include "util/spinlock.h"
+#include "util/worker_pool.h"
+#include "object/object_base.h"
+
+namespace collections {
+
+    // Owned by object_context. A deleted container with @threshold or more items gets its contents detached,
+    // the contents are destroyed by a job on the background worker pool, so the thread which deletes
+    // the container (an aqueue tick, a garbage collection slice) doesn't pay for the whole graph.
+    //
+    // The jobs delete the private objects orphaned by the contents, i.e. they delete objects off the serial strand.
+    // The garbage collector walks the registry only while it holds @jobs_lock exclusively
+    class deferred_destruction : boost::noncopyable {
+    public:
+
+        enum : uint32_t {
+            default_threshold = 1024,
+        };
+
+        struct stats {
+            uint64_t detached;  // amount of containers which contents were destroyed by the jobs
+            uint64_t pending;   // jobs submitted but not completed yet
+        };
+
+    private:
+
+        std::atomic<uint32_t> _threshold;
+        util::rw_spinlock _jobs_lock;
+
+        std::mutex _pending_mutex;
+        std::condition_variable _idle;
+        uint64_t _pending;
+        std::atomic<uint64_t> _detached;
+
+    public:
+
+        deferred_destruction()
+            : _threshold(default_threshold)
+            , _pending(0)
+            , _detached(0)
+        {}
+
+        ~deferred_destruction() {
+            wait_idle();
+        }
+
+        uint32_t threshold() const {
+            return _threshold.load(std::memory_order_relaxed);
+        }
+
+        // UINT32_MAX disables the deferral
+        void set_threshold(uint32_t threshold) {
+            _threshold.store(threshold, std::memory_order_relaxed);
+        }
+
+        bool should_defer(const object_base& obj) const {
+            return uint32_t(obj.u_count()) >= threshold();
+        }
+
+        // shared by the running jobs
+        util::rw_spinlock& jobs_lock() {
+            return _jobs_lock;
+        }
+
+        template<class Job>
+        void submit(Job&& job) {
+            {
+                std::lock_guard<std::mutex> g(_pending_mutex);
+                ++_pending;
+            }
+            _detached.fetch_add(1, std::memory_order_relaxed);
+
+            util::background_workers().submit([this, job = std::forward<Job>(job)]() mutable {
+                {
+                    util::rw_spinlock::shared_guard g(_jobs_lock);
+                    job();
+                }
+                std::lock_guard<std::mutex> g(_pending_mutex);
+                if (--_pending == 0) {
+                    _idle.notify_all();
+                }
+            });
+        }
+
+        // waits until the submitted jobs (and the jobs they submit) complete
+        void wait_idle() {
+            std::unique_lock<std::mutex> g(_pending_mutex);
+            _idle.wait(g, [this]() { return _pending == 0; });
+        }
+
+        stats get_stats() {
+            std::lock_guard<std::mutex> g(_pending_mutex);
+            return stats{ _detached.load(std::memory_order_relaxed), _pending };
+        }
+    };
+}
@@ -2,124 +2,559 @@
 
 namespace collections
 {
-    class garbage_collector
+    // Incremental tri-color mark & sweep collector
+    //
+    // white - the object's mark differs from the current cycle's one
+    // gray  - marked, sits in the _gray list and awaits its references to be visited
+    // black - marked and visited
+    //
+    // A cycle is split into slices of bounded duration, so it can run on the background worker while
+    // the game keeps accessing objects. The write barrier (object_base::write_barrier, called each time an object
+    // gets a new owner) shades white objects while a cycle is in progress, objects created during a cycle are born black.
+    //
+    // Objects may be held by a raw pointer for a while after they were created (e.g. while a graph
+    // is being built), so a background cycle treats the objects born since the previous cycle as roots.
+    //
+    // A stop-the-world collection marks on several threads at once (see parallel_marker)
+    class garbage_collector : boost::noncopyable
     {
     public:
 
         typedef std::deque<object_base* > object_list;
-        typedef std::unordered_set<object_base *> object_set;
+        typedef std::chrono::microseconds time_budget;
 
         struct result
         {
-            size_t garbage_total; // 
+            size_t garbage_total; //
             size_t part_of_graphs; //
             size_t root_count;
         };
 
-        static result u_collect(object_registry& registry, autorelease_queue& aqueue) {
+        enum class phase : uint8_t {
+            idle,
+            mark_roots,
+            mark,
+            sweep,
+        };
+
+        enum {
+            default_slice_budget = 2,   // milliseconds
+            work_chunk = 256,           // amount of objects processed between clock checks
+            max_mark_threads = 8,
+        };
+
+        static unsigned default_mark_threads() {
+            return (std::max)(1u, (std::min)(std::thread::hardware_concurrency(), unsigned(max_mark_threads)));
+        }
+
+    private:
+
+        object_registry& _registry;
+        deferred_destruction& _deferred;
+
+        std::atomic<phase> _phase;
+        // the mark of the current (or the latest) cycle, always even. Objects born between cycles have
+        // an odd mark, loaded objects have zero mark
+        std::atomic<uint32_t> _cycle;
+        bool _protect_young;
+        uint32_t _cursor;
+
+        counted_spinlock _gray_lock;
+        std::vector<object_base *> _gray;   // every gray object is held by a stack reference
+        std::vector<const object_base *> _hazard_roots; // sorted, objects held by stack_ref_batches when the cycle began
+
+        result _result;
+        result _last_result;
+
+        boost::asio::deadline_timer _timer;
+        std::mutex _timer_mutex;
+        bool _timer_stopped;
+        time_budget _slice_budget;
+
+    public:
+
+        util::lock_contention lock_contention() const {
+            return _gray_lock.contention();
+        }
+
+        garbage_collector(object_registry& registry, deferred_destruction& deferred)
+            : _registry(registry)
+            , _deferred(deferred)
+            , _phase(phase::idle)
+            , _cycle(2)
+            , _protect_young(true)
+            , _cursor(0)
+            , _result(result{ 0, 0, 0 })
+            , _last_result(result{ 0, 0, 0 })
+            , _timer(util::background_workers().io_service())
+            , _timer_stopped(false)
+            , _slice_budget(std::chrono::milliseconds(default_slice_budget))
+        {
+        }
 
-            auto findRootObjects = [&registry, &aqueue]() -> object_list {
-                object_list roots;// (root_objects.begin(), root_objects.end());
+        ~garbage_collector() {
+            stop();
+        }
+
+        phase current_phase() const {
+            return _phase.load(std::memory_order_acquire);
+        }
 
-                for (auto& obj : registry.u_all_objects()) {
-                    // stack ref. count not taken into account as this ref.count is not persistent
-                    if (obj->u_is_user_retains() || obj->is_in_aqueue()) {
-                        roots.push_back(obj);
+        const result& last_result() const {
+            return _last_result;
+        }
+
+        // requests a collection which runs on the background worker pool, in slices of @slice_budget duration
+        void request(time_budget slice_budget = std::chrono::milliseconds(default_slice_budget)) {
+            std::lock_guard<std::mutex> g(_timer_mutex);
+            _slice_budget = slice_budget;
+            if (current_phase() == phase::idle) {
+                u_begin_cycle(true);
+            }
+            if (!_timer_stopped) {
+                u_schedule_slice();
+            }
+        }
+
+        // pauses background slices (waits for the running one), the cycle will be resumed by @start
+        void stop() {
+            std::lock_guard<std::mutex> g(_timer_mutex);
+            _timer_stopped = true;
+            _timer.cancel();
+        }
+
+        void start() {
+            std::lock_guard<std::mutex> g(_timer_mutex);
+            if (_timer_stopped) {
+                _timer_stopped = false;
+                if (current_phase() != phase::idle) {
+                    u_schedule_slice();
+                }
+            }
+        }
+
+        // stop-the-world collection, no objects are treated as young ones
+        result u_collect(unsigned mark_threads = default_mark_threads()) {
+            std::lock_guard<util::rw_spinlock> jobs(_deferred.jobs_lock());
+            u_abort();
+            u_begin_cycle(false);
+            u_mark_parallel(mark_threads);
+            while (!u_step(time_budget::max())) {}
+            return _last_result;
+        }
+
+        // scans the roots and marks everything reachable from them on @thread_count threads.
+        // Returns the amount of objects visited
+        size_t u_mark_parallel(unsigned thread_count) {
+            jc_assert(current_phase() == phase::mark_roots);
+
+            auto marker = std::make_shared<parallel_marker>(*this, thread_count);
+            marker->run();
+
+            _result.root_count += marker->root_count();
+            // the objects shaded by the write barrier meanwhile are still in the _gray list, u_step visits them
+            _phase.store(phase::mark, std::memory_order_seq_cst);
+            return marker->visited_count();
+        }
+
+        void u_begin_cycle(bool protect_young) {
+            jc_assert(current_phase() == phase::idle);
+            _protect_young = protect_young;
+            _cursor = 0;
+            _result = result{ 0, 0, 0 };
+
+            {
+                counted_spinlock::guard g(_gray_lock);
+                _cycle.fetch_add(2, std::memory_order_relaxed);
+                _phase.store(phase::mark_roots, std::memory_order_seq_cst);
+            }
+
+            // an object a batch publishes from now on gets shaded by the write barrier
+            _hazard_roots.clear();
+            hazard_table::instance().visit([this](const object_base *obj) {
+                _hazard_roots.push_back(obj);
+            });
+            std::sort(_hazard_roots.begin(), _hazard_roots.end());
+        }
+
+        // runs the current cycle for about @budget time. Returns true if the cycle has been completed
+        bool u_step(time_budget budget) {
+            namespace chr = std::chrono;
+            const auto deadline = budget == time_budget::max()
+                ? chr::steady_clock::time_point::max()
+                : chr::steady_clock::now() + budget;
+
+            do {
+                switch (current_phase()) {
+                case phase::idle:
+                    return true;
+                case phase::mark_roots:
+                    u_mark_roots_chunk();
+                    break;
+                case phase::mark:
+                    u_mark_chunk();
+                    break;
+                case phase::sweep:
+                    if (u_sweep_chunk()) {
+                        return true;
                     }
+                    break;
                 }
+            } while (chr::steady_clock::now() < deadline);
+
+            return current_phase() == phase::idle;
+        }
+
+        // drops the cycle in progress
+        void u_abort() {
+            std::vector<object_base *> gray;
+            {
+                counted_spinlock::guard g(_gray_lock);
+                _phase.store(phase::idle, std::memory_order_seq_cst);
+                gray.swap(_gray);
+            }
+            // the objects are either about to be destroyed or owned by someone else,
+            // any way they are not going to be lost
+            for (auto obj : gray) {
+                obj->drop_ref<refs::stack>();
+            }
+        }
 
-                return roots;
+        // called each time an object gets a new owner
+        void write_barrier(object_base& obj) {
+            if (_phase.load(std::memory_order_seq_cst) != phase::idle) {
+                shade(obj);
+            }
+        }
+
+        // the mark a new object is born with - black during a cycle, young otherwise
+        uint32_t birth_mark() const {
+            const uint32_t cycle = _cycle.load(std::memory_order_relaxed);
+            return _phase.load(std::memory_order_seq_cst) != phase::idle ? cycle : cycle + 1;
+        }
+
+    private:
+
+        // Each marking thread owns a deque of objects to visit: it pushes and pops at the back and,
+        // once its own deque is exhausted, steals from the front of the others' ones.
+        // Object's mark word serves as the mark bit, an object gets into a deque only
+        // by the thread which has flipped the object's mark
+        //
+        // The calling thread marks on its own, the helpers are jobs of the background worker pool.
+        // A helper joins only while the marking is in progress - the pool may be busy (deferred destruction
+        // jobs stall on the jobs lock during a stop-the-world collection), a helper started late just quits.
+        // Late helpers still hold the marker, hence it's shared
+        class parallel_marker : public std::enable_shared_from_this<parallel_marker>, boost::noncopyable {
+
+            struct work_deque {
+                spinlock lock;
+                std::deque<object_base *> objects;
             };
 
-            // all-objects minus reachable-objects
-            auto findNonReachable = [&registry](const object_list& root_objects) -> object_set {
+            garbage_collector& _gc;
+            const uint32_t _mark;
+            std::vector<std::unique_ptr<work_deque>> _deques;
+
+            std::atomic<uint32_t> _root_cursor;
+            std::atomic<uint32_t> _active;      // amount of threads which may still produce work, never grows once zero
+            std::atomic<uint32_t> _joined;      // amount of threads which have joined, the index of the next one's deque
+            std::atomic<uint32_t> _running;     // amount of helpers which may touch the collector
+            std::atomic<size_t> _root_count;
+            std::atomic<size_t> _visited_count;
+
+        public:
+
+            parallel_marker(garbage_collector& gc, unsigned thread_count)
+                : _gc(gc)
+                , _mark(gc._cycle.load(std::memory_order_relaxed))
+                , _root_cursor(0)
+                , _active(1)
+                , _joined(1)
+                , _running(0)
+                , _root_count(0)
+                , _visited_count(0)
+            {
+                // no more helpers than the pool can run at once
+                thread_count = (std::min)(thread_count, util::background_workers().thread_count() + 1);
+                for (unsigned i = 0; i < (std::max)(thread_count, 1u); ++i) {
+                    _deques.emplace_back(new work_deque());
+                }
+            }
 
-                object_list objects_to_visit(root_objects);
-                object_set not_reachable = registry.u_all_objects(); // potentially huge op ?
+            size_t root_count() const { return _root_count.load(std::memory_order_relaxed); }
+            size_t visited_count() const { return _visited_count.load(std::memory_order_relaxed); }
 
-                for (auto& root : root_objects) {
-                    not_reachable.erase(root);
+            void run() {
+                auto self = shared_from_this();
+                for (size_t i = 1; i < _deques.size(); ++i) {
+                    util::background_workers().submit([self]() { self->help(); });
                 }
+                work(0);
 
-                std::function<void(object_base&)> visitor = [&objects_to_visit, &not_reachable](object_base& referenced) {
+                // the marking is over, no helper joins anymore. Wait for those which have joined
+                while (_running.load(std::memory_order_acquire) != 0) {
+                    std::this_thread::yield();
+                }
+            }
+
+        private:
 
-                    auto itr = not_reachable.find(&referenced);
-                    // is in not_reachable set? then is wasn't visited yet
-                    if (itr != not_reachable.end()) {
-                        not_reachable.erase(itr);
-                        objects_to_visit.push_back(&referenced);
+            void help() {
+                _running.fetch_add(1, std::memory_order_acq_rel);
+                if (try_activate()) {
+                    work(_joined.fetch_add(1, std::memory_order_relaxed));
+                }
+                _running.fetch_sub(1, std::memory_order_acq_rel);
+            }
+
+            // fails once every thread is idle: the marking is over
+            bool try_activate() {
+                uint32_t active = _active.load();
+                do {
+                    if (active == 0) {
+                        return false;
                     }
+                } while (!_active.compare_exchange_weak(active, active + 1));
+                return true;
+            }
+
+            void work(unsigned self) {
+                work_deque& own = *_deques[self];
+                std::function<void(object_base&)> visitor = [this, &own](object_base& referenced) {
+                    push_if_white(own, referenced);
                 };
 
-                object_list to_visit_temp;
-
-                while (!objects_to_visit.empty()) {
+                const uint32_t slot_count = _gc._registry.slot_count();
+                size_t roots = 0, visited = 0;
+
+                for (uint32_t begin = _root_cursor.fetch_add(work_chunk); begin < slot_count; begin = _root_cursor.fetch_add(work_chunk)) {
+                    const uint32_t end = (std::min)(begin + uint32_t(work_chunk), slot_count);
+                    for (uint32_t i = begin; i < end; ++i) {
+                        auto obj = _gc._registry.object_at(i);
+                        if (obj && _gc.u_is_root(*obj)) {
+                            push_if_white(own, *obj);
+                            ++roots;
+                        }
+                    }
+                }
 
-                    to_visit_temp.clear();
-                    to_visit_temp.swap(objects_to_visit);
+                for (;;) {
+                    object_base *obj = pop(own);
+                    if (!obj) {
+                        obj = steal(self);
+                    }
 
-                    for (auto& obj : to_visit_temp) {
+                    if (obj) {
+                        object_shared_lock g(obj);
                         obj->u_visit_referenced_objects(visitor);
+                        ++visited;
+                    }
+                    else if (!wait_for_work()) {
+                        break;
                     }
                 }
 
-                return not_reachable;
-            };
+                _root_count += roots;
+                _visited_count += visited;
+            }
 
-            // all-objects minus reachable-objects
-/*
-            auto findNonReachable2 = [&registry](const object_set& root_objects) -> object_set {
+            void push_if_white(work_deque& own, object_base& obj) {
+                if (obj._gc_mark.load(std::memory_order_relaxed) != _mark
+                    && obj._gc_mark.exchange(_mark, std::memory_order_acq_rel) != _mark)
+                {
+                    spinlock::guard g(own.lock);
+                    own.objects.push_back(&obj);
+                }
+            }
 
-                object_list objects_to_visit(root_objects.begin(), root_objects.end());
-                std::sort(objects_to_visit.begin(), objects_to_visit.end());
+            object_base* pop(work_deque& own) {
+                spinlock::guard g(own.lock);
+                if (own.objects.empty()) {
+                    return nullptr;
+                }
+                auto obj = own.objects.back();
+                own.objects.pop_back();
+                return obj;
+            }
+
+            object_base* steal(unsigned self) {
+                for (size_t i = 1; i < _deques.size(); ++i) {
+                    work_deque& victim = *_deques[(self + i) % _deques.size()];
+                    spinlock::guard g(victim.lock);
+                    if (!victim.objects.empty()) {
+                        auto obj = victim.objects.front();
+                        victim.objects.pop_front();
+                        return obj;
+                    }
+                }
+                return nullptr;
+            }
+
+            bool has_work() {
+                for (auto& deque : _deques) {
+                    spinlock::guard g(deque->lock);
+                    if (!deque->objects.empty()) {
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            // returns false if the marking is over: nothing to steal and every thread is idle
+            bool wait_for_work() {
+                --_active;
+                for (;;) {
+                    if (has_work()) {
+                        return try_activate();
+                    }
+                    if (_active.load() == 0) {
+                        return false;
+                    }
+                    std::this_thread::yield();
+                }
+            }
+        };
 
-                object_list not_reachable(registry.u_container().begin(), registry.u_container().end()); // potentially huge op ?
-                std::sort(not_reachable.begin(), not_reachable.end());
+        bool u_is_root(const object_base& obj) const {
+            // stack references are taken into account as well - the game runs while a cycle is in progress
+            return obj.u_is_user_retains() || obj.is_in_aqueue()
+                || obj.ref_count<refs::stack>(std::memory_order_relaxed) > 0 || u_is_young(obj)
+                || (!_hazard_roots.empty() && std::binary_search(_hazard_roots.begin(), _hazard_roots.end(), &obj));
+        }
 
-                object_list reachable;
+        bool u_is_marked(const object_base& obj) const {
+            return obj._gc_mark.load(std::memory_order_acquire) == _cycle.load(std::memory_order_relaxed);
+        }
 
-                std::function<void(object_base&)> visitor = [&objects_to_visit, &not_reachable](object_base& referenced) {
-                    objects_to_visit.push_back(&referenced);
-                };
+        bool u_is_young(const object_base& obj) const {
+            return _protect_young && obj._gc_mark.load(std::memory_order_relaxed) + 1 == _cycle.load(std::memory_order_relaxed);
+        }
 
-                object_list to_visit_temp;
+        void shade(object_base& obj) {
+            const uint32_t mark = _cycle.load(std::memory_order_relaxed);
+            if (obj._gc_mark.load(std::memory_order_acquire) == mark) {
+                return;
+            }
+
+            counted_spinlock::guard g(_gray_lock);
+            const auto ph = _phase.load(std::memory_order_relaxed);
+            if (ph == phase::idle) {
+                return;
+            }
+            // an object shaded during the sweep has been resurrected by a handle lookup - it just won't be swept
+            if (obj._gc_mark.exchange(mark, std::memory_order_acq_rel) != mark && ph != phase::sweep) {
+                obj.add_ref<refs::stack>(); // not stack_retain - it would trigger the barrier again
+                _gray.push_back(&obj);
+            }
+        }
 
-                while (!objects_to_visit.empty()) {
+        void u_mark_roots_chunk() {
+            const uint32_t end = (std::min)(_cursor + work_chunk, _registry.slot_count());
 
-                    to_visit_temp.clear();
-                    to_visit_temp.swap(objects_to_visit);
+            for (; _cursor < end; ++_cursor) {
+                auto obj = _registry.object_at(_cursor);
+                if (obj && u_is_root(*obj)) {
+                    shade(*obj);
+                    ++_result.root_count;
+                }
+            }
 
-                    std::setdiff
-                    not_reachable -= objects_to_visit;
+            if (_cursor >= _registry.slot_count()) {
+                _phase.store(phase::mark, std::memory_order_seq_cst);
+            }
+        }
 
-                    for (auto& obj : to_visit_temp) {
-                        obj->u_visit_referenced_objects(visitor);
-                    }
+        void u_mark_chunk() {
+            std::vector<object_base *> chunk;
+            {
+                counted_spinlock::guard g(_gray_lock);
+                if (_gray.empty()) {
+                    // nothing is gray and the barrier pushes no more objects, the marking is over
+                    _cursor = 0;
+                    _phase.store(phase::sweep, std::memory_order_seq_cst);
+                    return;
+                }
+
+                const size_t count = (std::min)(_gray.size(), size_t(work_chunk));
+                chunk.assign(_gray.end() - count, _gray.end());
+                _gray.resize(_gray.size() - count);
+            }
+
+            std::function<void(object_base&)> visitor = [this](object_base& referenced) {
+                shade(referenced);
+            };
+
+            for (auto obj : chunk) {
+                {
+                    object_shared_lock g(obj);
+                    obj->u_visit_referenced_objects(visitor);
                 }
+                obj->stack_release();
+            }
+        }
 
-                return not_reachable;
-            };*/
+        // returns true if the cycle has been completed
+        bool u_sweep_chunk() {
+            const uint32_t end = (std::min)(_cursor + work_chunk, _registry.slot_count());
 
+            for (; _cursor < end; ++_cursor) {
+                auto obj = _registry.object_at(_cursor);
+                if (!obj || u_is_marked(*obj) || u_is_young(*obj)) {
+                    continue;
+                }
 
-            auto collectGarbage = [&registry](const object_set& garbage) -> result {
-                size_t part_of_graphs = 0;
+                ++_result.garbage_total;
 
-                for (auto& obj : garbage) {
-                    if (obj->noOwners() == false) { // an object is part of a graph
-                        // the object's ref. count in the unreachable graphs reaches zero -> all objects are moved into aqueue
-                        obj->u_clear();
-                        ++part_of_graphs;
+                if (obj->noOwners() == false) { // an object is part of a graph
+                    // the object's ref. count in the unreachable graphs reaches zero -> all objects are moved into aqueue
+                    obj->s_clear();
+                    ++_result.part_of_graphs;
+                }
+                else {
+                    obj->_delete_self();
+                }
+            }
+
+            if (_cursor < _registry.slot_count()) {
+                return false;
+            }
+
+            {
+                counted_spinlock::guard g(_gray_lock);
+                jc_assert(_gray.empty());
+                _phase.store(phase::idle, std::memory_order_seq_cst);
+            }
+            _last_result = _result;
+            return true;
+        }
+
+        void u_schedule_slice() {
+            boost::system::error_code code;
+            _timer.expires_from_now(boost::posix_time::microseconds(_slice_budget.count()), code);
+            assert(!code);
+
+            // slices never overlap with aqueue ticks, the rest of the pool's jobs may run meanwhile
+            _timer.async_wait(util::background_workers().serial().wrap([this](const boost::system::error_code& error) {
+                if (error) { // cancelled
+                    return;
+                }
+
+                std::lock_guard<std::mutex> g(this->_timer_mutex);
+                if (!this->_timer_stopped) {
+                    // the objects deferred_destruction's jobs delete can't be walked over, the slice waits for them
+                    std::unique_lock<util::rw_spinlock> jobs(this->_deferred.jobs_lock(), std::try_to_lock);
+                    if (!jobs.owns_lock()) {
+                        this->u_schedule_slice();
+                    }
+                    else if (this->u_step(this->_slice_budget)) {
+                        JC_log("%u garbage objects collected. %u objects are parts of cyclic graphs",
+                            this->_last_result.garbage_total, this->_last_result.part_of_graphs);
                     }
                     else {
-                        obj->_delete_self();
+                        this->u_schedule_slice();
                     }
                 }
-                
-                return result{ garbage.size(), part_of_graphs };
-            };
-
-            return collectGarbage(findNonReachable(findRootObjects()));
+            }));
         }
-
     };
 }
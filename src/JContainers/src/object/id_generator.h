@@ -1,7 +1,18 @@
 #pragma once
 
+#include <intrin.h>
+#include <vector>
+#include <deque>
+#include <sstream>
+#include <random>
+#include <set>
+#include <stdexcept>
+
 namespace collections {
 
+    // Hands out unique identifiers in [min_identifier, max_identifier] range.
+    // Free identifiers are tracked by a two-level bitmap: reuse_id is a couple of bit flips and new_id finds
+    // the lowest free identifier through the summary level, no matter how fragmented the free identifiers are
     template<
         class id,
         id min_identifier,
@@ -49,107 +60,228 @@ namespace collections {
             }
         };
 
-        std::deque<range> _empty_ranges;
-        typename std::deque<range>::iterator _current_range;
+    private:
 
-        id_generator() {
-            u_clear();
-        }
+        typedef uint32_t word;
+        enum : uint32_t {
+            word_bits = 32,
+            npos = uint32_t(-1),
+            capacity = uint32_t(max_identifier - min_identifier) + 1,
+        };
 
-        id new_id() {
-            assert(_empty_ranges.empty() == false);
-            range& rn = *_current_range;
-            auto num = rn.new_id();
+        // Identifiers are stored as offsets from min_identifier. A set bit of _free marks a free identifier,
+        // a set bit of _summary marks a word of _free that has a free identifier.
+        // The bitmap covers offsets below _limit only - the identifiers at and above it have never been handed out
+        std::vector<word> _free;
+        std::vector<word> _summary;
+        uint32_t _limit;
+        uint32_t _cursor;   // no identifier below it is free, the search for a free identifier starts here
+
+        static uint32_t lowest_bit(word w) {
+            unsigned long idx = 0;
+            _BitScanForward(&idx, w);
+            return idx;
+        }
 
-            if (rn.empty()) {
-                _current_range = _empty_ranges.erase(_current_range);
+        // bits at and above @bit
+        static word mask_from(uint32_t bit) {
+            return ~word(0) << bit;
+        }
 
-                if (_current_range == _empty_ranges.end()) {
-                    _current_range = _empty_ranges.begin();
-                }
+        void u_mark_used(uint32_t off) {
+            word& w = _free[off / word_bits];
+            w &= ~(word(1) << (off % word_bits));
+            if (w == 0) {
+                const uint32_t wi = off / word_bits;
+                _summary[wi / word_bits] &= ~(word(1) << (wi % word_bits));
             }
-
-            return num;
         }
 
-        void u_clear() {
-            _empty_ranges = {
-                range::with_first_last(min_identifier, max_identifier)
-            };
-            _current_range = _empty_ranges.begin();
+        void u_mark_free(uint32_t off) {
+            const uint32_t wi = off / word_bits;
+            _free[wi] |= word(1) << (off % word_bits);
+            _summary[wi / word_bits] |= word(1) << (wi % word_bits);
         }
 
-        bool is_free_id(id val) const {
-            range fake = range::with_first_last(val, val);
-            // right > val
-            auto right = std::upper_bound(_empty_ranges.begin(), _empty_ranges.end(), fake);
-            const range *leftRange = (right > _empty_ranges.begin() ? &*(right - 1) : nullptr);
+        // makes the bitmap cover offsets below @limit, the new ones are used
+        void u_resize(uint32_t limit) {
+            _limit = limit;
+            const uint32_t words = (limit + word_bits - 1) / word_bits;
+            _free.resize(words, 0);
+            _summary.resize((words + word_bits - 1) / word_bits, 0);
+        }
 
-            return (leftRange && leftRange->begin() <= val && val < leftRange->end());
+        // marks [first, end) offsets free
+        void u_fill_free(uint32_t first, uint32_t end) {
+            while (first < end) {
+                const uint32_t wi = first / word_bits;
+                const uint32_t span = (std::min)(end - first, word_bits - first % word_bits);
+                const word bits = (span == word_bits ? ~word(0) : ((word(1) << span) - 1)) << (first % word_bits);
+                _free[wi] |= bits;
+                _summary[wi / word_bits] |= word(1) << (wi % word_bits);
+                first += span;
+            }
         }
 
-        bool is_valid() const {
-            auto noOverlap = [&]() {
-                for (size_t i = 1; i < _empty_ranges.size(); ++i) {
-                    const auto& prev = _empty_ranges[i - 1];
-                    const auto& curr = _empty_ranges[i];
+        // the first free offset in [from, _limit)
+        uint32_t u_find_free(uint32_t from) const {
+            if (from >= _limit) {
+                return npos;
+            }
 
-                    if (!(prev.begin() < curr.begin() && prev.end() < curr.end())) {
-                        return false;
+            uint32_t wi = from / word_bits;
+            word bits = _free[wi] & mask_from(from % word_bits);
+            if (!bits) {
+                // the summary points to the next word with a free bit
+                const uint32_t next = wi + 1;
+                if (next >= _free.size()) {
+                    return npos;
+                }
+                uint32_t si = next / word_bits;
+                word summary = _summary[si] & mask_from(next % word_bits);
+                while (!summary) {
+                    if (++si == _summary.size()) {
+                        return npos;
                     }
+                    summary = _summary[si];
                 }
+                wi = si * word_bits + lowest_bit(summary);
+                bits = _free[wi];
+            }
 
-                return true;
-            };
+            return wi * word_bits + lowest_bit(bits);
+        }
+
+    public:
 
-            return !_empty_ranges.empty() && _current_range != _empty_ranges.end() && noOverlap();
+        id_generator() {
+            u_clear();
         }
 
-        void reuse_id(id val) {
-            range fake = range::with_first_last(val, val);
-            // right >= val
-            auto right = std::lower_bound(_empty_ranges.begin(), _empty_ranges.end(), fake);
+        bool has_free_id() const {
+            return _limit < capacity || u_find_free(_cursor) != npos;
+        }
+
+        // hands out the lowest free identifier, so the identifiers in use stay packed at the bottom of the range.
+        // Throws std::length_error if all identifiers are in use
+        id new_id() {
+            uint32_t off = u_find_free(_cursor);
+            if (off == npos) {
+                if (_limit == capacity) {
+                    throw std::length_error("id_generator: all identifiers are in use");
+                }
+                off = _limit;
+                u_resize(_limit + 1);
+                _cursor = off + 1;
+                return id(min_identifier + off);
+            }
 
-            range *leftRange = (right > _empty_ranges.begin() ? &*(right - 1) : nullptr);
-            leftRange = (leftRange && leftRange->end() == val ? leftRange : nullptr);
+            u_mark_used(off);
+            _cursor = off + 1;
+            return id(min_identifier + off);
+        }
 
-            range *rightRange = (right != _empty_ranges.end() ? &*(right) : nullptr);
-            rightRange = (rightRange && rightRange->begin() - 1 == val ? rightRange : nullptr);
+        void reuse_id(id val) {
+            const uint32_t off = uint32_t(val - min_identifier);
+            assert(off < _limit && !is_free_id(val));
+            u_mark_free(off);
+            _cursor = (std::min)(_cursor, off);
+        }
 
-            if (!leftRange && !rightRange) {
-                size_t idx = _current_range - _empty_ranges.begin() + (_current_range < right ? 0 : 1);
-                _empty_ranges.insert(right, fake);
-                _current_range = _empty_ranges.begin() + idx;
+        void u_clear() {
+            _free.clear();
+            _summary.clear();
+            _limit = 0;
+            _cursor = 0;
+        }
 
-                assert(_current_range != _empty_ranges.end());
-            }
-            else if (rightRange && leftRange) {
-                // merge ranges
-                leftRange->last = rightRange->last;
-                // _current_range becomes ivnalid each time we modify _empty_ranges
-                size_t idx = _current_range - _empty_ranges.begin() - (_current_range < right ? 0 : 1);
-                _empty_ranges.erase(right);
-                _current_range = _empty_ranges.begin() + idx;
+        // rebuilds the free identifiers out of sorted identifiers that are in use
+        template<class Container>
+        void u_assign_used_ids(const Container& used) {
+            jc_assert(std::is_sorted(used.begin(), used.end()));
 
-                assert(_current_range != _empty_ranges.end());
+            u_clear();
+            if (used.empty()) {
+                return;
             }
-            else if (leftRange) {
-                leftRange->last = val;
+
+            u_resize(uint32_t(used.back() - min_identifier) + 1);
+            u_fill_free(0, _limit);
+            for (id val : used) {
+                u_mark_used(uint32_t(val - min_identifier));
             }
-            else if (rightRange) {
-                rightRange->first = val;
+            _cursor = 0;
+        }
+
+        bool is_free_id(id val) const {
+            const uint32_t off = uint32_t(val - min_identifier);
+            return off >= _limit || (_free[off / word_bits] & (word(1) << (off % word_bits))) != 0;
+        }
+
+        bool is_valid() const {
+            for (uint32_t wi = 0; wi < _free.size(); ++wi) {
+                const bool has_free = (_summary[wi / word_bits] & (word(1) << (wi % word_bits))) != 0;
+                if (has_free != (_free[wi] != 0)) {
+                    return false;
+                }
             }
+            // nothing is free below the cursor or beyond the limit as far as the bitmap is concerned
+            const uint32_t lowest = u_find_free(0);
+            const uint32_t tail = _limit % word_bits;
+            return _cursor <= capacity && (lowest == npos || lowest >= _cursor)
+                && (tail == 0 || (_free.back() & mask_from(tail)) == 0);
         }
 
         //////////////////////////////////////////////////////////////////////////
-        
+
         friend class boost::serialization::access;
         BOOST_SERIALIZATION_SPLIT_MEMBER();
 
+        // The archive keeps the format of the range-based generator: sorted free ranges
+        // and the index of the range the next identifier comes from
         template<class Archive>
         void save(Archive & ar, const unsigned int version) const {
-            size_t currIdx = _current_range - _empty_ranges.begin();
-            ar << _empty_ranges << currIdx;
+            std::deque<range> empty_ranges;
+
+            for (uint32_t off = u_find_free(0); off != npos;) {
+                uint32_t last = off;
+                // runs of free identifiers are mostly long, whole words get skipped
+                while (last + 1 < _limit) {
+                    const uint32_t next = last + 1;
+                    if (next % word_bits == 0 && _free[next / word_bits] == ~word(0)) {
+                        last += word_bits;
+                    }
+                    else if (_free[next / word_bits] & (word(1) << (next % word_bits))) {
+                        last = next;
+                    }
+                    else {
+                        break;
+                    }
+                }
+                empty_ranges.push_back(range::with_first_last(id(min_identifier + off), id(min_identifier + last)));
+                off = last + 1 < _limit ? u_find_free(last + 1) : npos;
+            }
+
+            if (_limit < capacity) {
+                const id first = id(min_identifier + _limit);
+                if (!empty_ranges.empty() && empty_ranges.back().end() == first) {
+                    empty_ranges.back().last = max_identifier;
+                }
+                else {
+                    empty_ranges.push_back(range::with_first_last(first, max_identifier));
+                }
+            }
+
+            const id cursor = id(min_identifier + (std::min)(_cursor, uint32_t(capacity - 1)));
+            size_t currIdx = 0;
+            while (currIdx < empty_ranges.size() && empty_ranges[currIdx].last < cursor) {
+                ++currIdx;
+            }
+            if (currIdx == empty_ranges.size()) {
+                currIdx = 0;
+            }
+
+            ar << empty_ranges << currIdx;
         }
 
         template<class Archive>
@@ -161,11 +293,44 @@ namespace collections {
                 jc_assert(false);
                 break;
             case 1: {
+                std::deque<range> empty_ranges;
                 size_t currIdx = 0;
 
-                ar >> _empty_ranges >> currIdx;
+                ar >> empty_ranges >> currIdx;
+
+                u_clear();
+
+                // ranges out of [min_identifier, max_identifier] are ignored or trimmed
+                std::deque<range> free_ranges;
+                for (const auto& rn : empty_ranges) {
+                    if (rn.first <= rn.last && rn.last >= min_identifier && rn.first <= max_identifier) {
+                        free_ranges.push_back(range::with_first_last(
+                            (std::max)(rn.first, min_identifier), (std::min)(rn.last, max_identifier)));
+                    }
+                }
+                std::sort(free_ranges.begin(), free_ranges.end());
+
+                // the bitmap ends right after the greatest identifier in use: the free ranges at the top of
+                // the identifier space cover the identifiers which have never been handed out
+                uint32_t limit = capacity;
+                for (auto rn = free_ranges.rbegin(); rn != free_ranges.rend() && limit != 0; ++rn) {
+                    if (uint32_t(rn->last - min_identifier) + 1 < limit) {
+                        break;
+                    }
+                    limit = (std::min)(limit, uint32_t(rn->first - min_identifier));
+                }
+
+                u_resize(limit);
+                for (const auto& rn : free_ranges) {
+                    const uint32_t first = uint32_t(rn.first - min_identifier);
+                    const uint32_t end = (std::min)(uint32_t(rn.last - min_identifier) + 1, _limit);
+                    if (first < end) {
+                        u_fill_free(first, end);
+                    }
+                }
 
-                _current_range = _empty_ranges.begin() + currIdx;
+                // the lowest free identifier comes next, whatever range the archive points to
+                _cursor = 0;
             }
                 break;
             }
@@ -208,6 +373,168 @@ namespace collections {
         }
     }
 
+    TEST(id_generator, lowest_free_first)
+    {
+        id_generator<uint16_t, 1, 1000> gen;
+        for (int i = 0; i < 100; ++i) {
+            gen.new_id();
+        }
+
+        gen.reuse_id(70);
+        gen.reuse_id(20);
+        gen.reuse_id(50);
+        EXPECT_TRUE(gen.is_valid());
+
+        // the freed identifiers are reused right away, the lowest one first
+        EXPECT_EQ(gen.new_id(), 20);
+        EXPECT_EQ(gen.new_id(), 50);
+        EXPECT_EQ(gen.new_id(), 70);
+        EXPECT_EQ(gen.new_id(), 101);
+        EXPECT_TRUE(gen.is_valid());
+    }
+
+    TEST(id_generator, archive_compatibility)
+    {
+        typedef id_generator<uint16_t, 1, 1000> generator;
+        typedef generator::range range;
+
+        // an archive written by the range-based generator
+        std::deque<range> ranges = {
+            range::with_first_last(3, 9),
+            range::with_first_last(100, 100),
+            range::with_first_last(500, 1000),
+        };
+        std::stringstream stream;
+        {
+            boost::archive::binary_oarchive arch(stream);
+            size_t currIdx = 1;
+            arch << ranges << currIdx;
+        }
+
+        generator gen;
+        {
+            boost::archive::binary_iarchive arch(stream);
+            gen.load(arch, 1);
+        }
+        EXPECT_TRUE(gen.is_valid());
+        EXPECT_FALSE(gen.is_free_id(1));
+        EXPECT_TRUE(gen.is_free_id(3));
+        EXPECT_TRUE(gen.is_free_id(9));
+        EXPECT_FALSE(gen.is_free_id(10));
+        EXPECT_TRUE(gen.is_free_id(700));
+        EXPECT_EQ(gen.new_id(), 3); // the lowest free identifier
+
+        // and it writes the same format back
+        gen.reuse_id(3);
+        std::stringstream out;
+        {
+            boost::archive::binary_oarchive arch(out);
+            gen.save(arch, 1);
+        }
+        std::deque<range> saved;
+        size_t savedIdx = 0;
+        {
+            boost::archive::binary_iarchive arch(out);
+            arch >> saved >> savedIdx;
+        }
+        EXPECT_EQ(saved.size(), ranges.size());
+        for (size_t i = 0; i < saved.size() && i < ranges.size(); ++i) {
+            EXPECT_EQ(saved[i].first, ranges[i].first);
+            EXPECT_EQ(saved[i].last, ranges[i].last);
+        }
+        EXPECT_EQ(savedIdx, 0u); // the lowest free identifiers come next
+    }
+
+    TEST(id_generator, archive_without_tail)
+    {
+        typedef id_generator<uint16_t, 1, 1000> generator;
+        typedef generator::range range;
+
+        // the greatest identifier is in use, the ranges come unsorted and one of them is out of bounds
+        std::deque<range> ranges = {
+            range::with_first_last(50, 60),
+            range::with_first_last(0, 9),
+            range::with_first_last(990, 999),
+        };
+        std::stringstream stream;
+        {
+            boost::archive::binary_oarchive arch(stream);
+            size_t currIdx = 0;
+            arch << ranges << currIdx;
+        }
+
+        generator gen;
+        {
+            boost::archive::binary_iarchive arch(stream);
+            gen.load(arch, 1);
+        }
+        EXPECT_TRUE(gen.is_valid());
+        EXPECT_TRUE(gen.is_free_id(55));
+        EXPECT_FALSE(gen.is_free_id(100));
+        EXPECT_TRUE(gen.is_free_id(999));
+        EXPECT_FALSE(gen.is_free_id(1000));
+        EXPECT_EQ(gen.new_id(), 1);
+    }
+
+    TEST(id_generator, churn)
+    {
+        typedef id_generator<HandleT, 1, (1 << 21) - 1> generator;
+        enum { live_count = 50000, rounds = 20000 };
+
+        generator gen;
+        std::vector<HandleT> live;
+        HandleT fresh = 1;
+        for (int i = 0; i < live_count; ++i) {
+            live.push_back(gen.new_id());
+            EXPECT_EQ(live.back(), fresh++);
+        }
+
+        // random frees fragment the free identifiers, the lowest one must still come first
+        std::mt19937 rng(12345);
+        std::set<HandleT> freed;
+        int unexpected = 0;
+        for (int i = 0; i < rounds; ++i) {
+            for (uint32_t k = rng() % 64; k > 0; --k) {
+                auto& slot = live[rng() % live.size()];
+                gen.reuse_id(slot);
+                freed.insert(slot);
+                std::swap(slot, live.back());
+                live.pop_back();
+            }
+            while (live.size() < live_count) {
+                HandleT expected = fresh;
+                if (!freed.empty()) {
+                    expected = *freed.begin();
+                    freed.erase(freed.begin());
+                }
+                else {
+                    ++fresh;
+                }
+                live.push_back(gen.new_id());
+                unexpected += live.back() != expected;
+            }
+        }
+
+        EXPECT_EQ(unexpected, 0);
+        EXPECT_TRUE(gen.is_valid());
+    }
+
+    TEST(id_generator, exhaustion)
+    {
+        id_generator<uint16_t, 1, 100> gen;
+        for (int i = 0; i < 100; ++i) {
+            gen.new_id();
+        }
+
+        EXPECT_FALSE(gen.has_free_id());
+        EXPECT_THROW(gen.new_id(), std::length_error);
+        EXPECT_TRUE(gen.is_valid());
+
+        gen.reuse_id(40);
+        EXPECT_TRUE(gen.has_free_id());
+        EXPECT_EQ(gen.new_id(), 40);
+    }
+
 #   endif
 
 }
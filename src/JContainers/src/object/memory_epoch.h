@@ -0,0 +1,85 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <boost/noncopyable.hpp>
+
+namespace collections {
+
+    // Epoch-based protection of memory that lock-free readers may still observe.
+    //
+    // A reader enters a critical section (see @guard) and publishes the epoch it has started in.
+    // A writer first unlinks a piece of memory (so that new readers can't find it anymore),
+    // then gets the epoch the memory has been retired at with @retire_epoch.
+    // The memory can be released once @oldest_active is greater than that epoch -
+    // no reader which may have seen the memory before it got unlinked remains
+    class memory_epoch : boost::noncopyable {
+    public:
+
+        enum : uint32_t {
+            max_readers = 128,
+        };
+
+    private:
+
+        // one cache line per reader, so that readers of different threads don't share lines
+        struct reader {
+            std::atomic<uint64_t> epoch; // 0 - the record is free
+            char _pad[64 - sizeof(std::atomic<uint64_t>)];
+        };
+
+        std::atomic<uint64_t> _global;
+        reader _readers[max_readers];
+
+    public:
+
+        class guard : boost::noncopyable {
+            reader *_reader;
+        public:
+            explicit guard(memory_epoch& epoch) : _reader(epoch.enter()) {}
+            ~guard() { _reader->epoch.store(0, std::memory_order_release); }
+        };
+
+        memory_epoch() : _global(1) {
+            for (auto& r : _readers) {
+                r.epoch.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // to be called after memory got unlinked. Returns the epoch the memory retires at
+        uint64_t retire_epoch() {
+            return _global.fetch_add(1, std::memory_order_seq_cst);
+        }
+
+        // the epoch of the oldest reader in a critical section.
+        // memory retired at an epoch lower than the result is safe to release
+        uint64_t oldest_active() const {
+            uint64_t oldest = _global.load(std::memory_order_seq_cst);
+            for (auto& r : _readers) {
+                auto epoch = r.epoch.load(std::memory_order_seq_cst);
+                if (epoch != 0 && epoch < oldest) {
+                    oldest = epoch;
+                }
+            }
+            return oldest;
+        }
+
+    private:
+
+        reader* enter() {
+            // readers of the same thread tend to occupy the same record
+            size_t idx = std::hash<std::thread::id>()(std::this_thread::get_id());
+            for (;; ++idx) {
+                reader& r = _readers[idx % max_readers];
+                uint64_t free = 0;
+                if (r.epoch.load(std::memory_order_relaxed) == 0 &&
+                    r.epoch.compare_exchange_strong(free, _global.load(std::memory_order_seq_cst), std::memory_order_seq_cst))
+                {
+                    return &r;
+                }
+            }
+        }
+    };
+
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <thread>
+#include <boost/noncopyable.hpp>
+
+#include "util/spinlock.h"
+#include "object/object_base.h"
+#include "object/memory_epoch.h"
+
+namespace collections {
+
+    // Size-class slab allocator, owned by object_context. Every collection object created through
+    // collection_base<T>::make lives here - objects of similar size share a class and their memory is
+    // carved out of large slabs and recycled through the class' free list, so the create/destroy churn
+    // of short-living temporary containers never reaches the general heap.
+    //
+    // boost.serialization creates loaded objects with 'new' - object_base::operator new takes the memory from
+    // the allocator the load_scope of the thread points to. Objects created elsewhere keep object_base::_slab_class zero
+    // and their memory is returned to the general heap.
+    //
+    // A destroyed object's memory isn't reused immediately: object_registry resolves handles without a lock,
+    // so a reader may still be touching the object. The memory is retired and gets released once
+    // the memory_epoch tells that no such reader remains
+    class object_allocator : boost::noncopyable {
+    public:
+
+        enum : size_t {
+            granularity = 16,
+            max_object_size = 512,     // JArray and JMap carry their first items inline
+            class_count = max_object_size / granularity,
+            slab_size = 64 * 1024,
+            reclaim_batch = 256,    // amount of retired cells which triggers reclamation
+        };
+
+        struct stats {
+            size_t slab_count;
+            size_t reserved_bytes;  // memory taken from the heap
+            size_t used_bytes;      // memory occupied by live objects
+        };
+
+    private:
+
+        struct free_cell {
+            free_cell *next;
+        };
+
+        struct retired_memory {
+            void *memory;
+            uint64_t epoch;
+            uint8_t cls;
+        };
+
+        struct size_class {
+            spinlock lock;
+            free_cell *free_list = nullptr;
+            char *bump = nullptr;       // not yet used tail of the latest slab
+            char *bump_end = nullptr;
+            size_t in_use = 0;
+        };
+
+        size_class _classes[class_count];
+
+        spinlock _slabs_lock;
+        std::vector<void *> _slabs;
+
+        memory_epoch _epoch;
+        spinlock _retired_lock;
+        std::vector<retired_memory> _retired;
+
+    public:
+
+        // while alive, objects created with 'new' on the thread are allocated by @allocator
+        class load_scope : boost::noncopyable {
+            object_allocator *_previous;
+        public:
+            explicit load_scope(object_allocator& allocator) : _previous(current_loading()) {
+                current_loading() = &allocator;
+            }
+            ~load_scope() {
+                current_loading() = _previous;
+            }
+        };
+
+        static object_allocator*& current_loading() {
+            static thread_local object_allocator *allocator = nullptr;
+            return allocator;
+        }
+
+        object_allocator() = default;
+
+        ~object_allocator() {
+            for (auto& r : _retired) {
+                release_memory(r.memory, r.cls);
+            }
+            _retired.clear();
+            u_release_slabs();
+        }
+
+        memory_epoch& epoch() { return _epoch; }
+
+        // constructs T in a slab cell (or on the heap if T is too large to have a size class)
+        template<class T>
+        T& make() {
+            static_assert(std::is_base_of<object_base, T>::value, "");
+
+            const uint8_t cls = class_of(sizeof(T));
+            void *memory = cls ? allocate(cls) : ::operator new(sizeof(T));
+
+            T *obj = nullptr;
+            try {
+                object_base::constructing_slab_class() = cls;
+                obj = new (memory) T();
+            }
+            catch (...) {
+                object_base::constructing_slab_class() = 0;
+                cls ? deallocate(memory, cls) : ::operator delete(memory);
+                throw;
+            }
+
+            return *obj;
+        }
+
+        // destroys an object, regardless of the way it was allocated. The memory gets retired
+        void destroy(object_base *obj) {
+            const uint8_t cls = obj->_slab_class;
+            obj->~object_base();
+
+            const uint64_t epoch = _epoch.retire_epoch();
+            bool should_reclaim = false;
+            {
+                spinlock::guard g(_retired_lock);
+                _retired.push_back(retired_memory{ obj, epoch, cls });
+                should_reclaim = _retired.size() >= reclaim_batch;
+            }
+
+            if (should_reclaim) {
+                reclaim();
+            }
+        }
+
+        // releases retired memory which can't be observed by readers anymore
+        void reclaim() {
+            const uint64_t oldest = _epoch.oldest_active();
+
+            std::vector<retired_memory> reclaimable;
+            {
+                spinlock::guard g(_retired_lock);
+                auto itr = std::partition(_retired.begin(), _retired.end(), [oldest](const retired_memory& r) {
+                    return r.epoch >= oldest;
+                });
+                reclaimable.assign(itr, _retired.end());
+                _retired.erase(itr, _retired.end());
+            }
+
+            for (auto& r : reclaimable) {
+                release_memory(r.memory, r.cls);
+            }
+        }
+
+        // object_context::u_clearState: destroys an object which memory gets released in bulk by @u_release_all
+        void u_destroy_in_bulk(object_base *obj) {
+            const uint8_t cls = obj->_slab_class;
+            obj->~object_base();
+            if (!cls) { // the general heap's memory can't be released in bulk
+                _retired.push_back(retired_memory{ obj, 0, 0 });
+            }
+        }
+
+        // releases every slab at once, no object may live in them anymore
+        void u_release_all() {
+            // the lock-free readers which may still see the objects leave their critical sections
+            const uint64_t epoch = _epoch.retire_epoch();
+            while (_epoch.oldest_active() <= epoch) {
+                std::this_thread::yield();
+            }
+
+            for (auto& r : _retired) {
+                if (!r.cls) {
+                    ::operator delete(r.memory);
+                }
+            }
+            _retired.clear();
+            u_release_slabs();
+        }
+
+        // the memory of an object created with 'new', see object_base::operator new
+        void* allocate_loaded(size_t size, uint8_t& cls) {
+            cls = class_of(size);
+            return cls ? allocate(cls) : ::operator new(size);
+        }
+
+        void deallocate_loaded(void *memory, size_t size) {
+            release_memory(memory, class_of(size));
+        }
+
+        stats get_stats() {
+            stats st = { 0, 0, 0 };
+            {
+                spinlock::guard g(_slabs_lock);
+                st.slab_count = _slabs.size();
+                st.reserved_bytes = _slabs.size() * slab_size;
+            }
+            for (size_t i = 0; i < class_count; ++i) {
+                spinlock::guard g(_classes[i].lock);
+                st.used_bytes += _classes[i].in_use * cell_size(uint8_t(i + 1));
+            }
+            return st;
+        }
+
+    private:
+
+        // 0 means 'no size class', otherwise the class index + 1
+        static uint8_t class_of(size_t size) {
+            return size <= max_object_size ? uint8_t((size + granularity - 1) / granularity) : 0;
+        }
+
+        static size_t cell_size(uint8_t cls) {
+            return cls * granularity;
+        }
+
+        void* allocate(uint8_t cls) {
+            size_class& sc = _classes[cls - 1];
+            const size_t size = cell_size(cls);
+
+            spinlock::guard g(sc.lock);
+            ++sc.in_use;
+
+            if (free_cell *cell = sc.free_list) {
+                sc.free_list = cell->next;
+                return cell;
+            }
+
+            if (size_t(sc.bump_end - sc.bump) < size) {
+                sc.bump = static_cast<char *>(new_slab());
+                sc.bump_end = sc.bump + slab_size;
+            }
+
+            void *memory = sc.bump;
+            sc.bump += size;
+            return memory;
+        }
+
+        void deallocate(void *memory, uint8_t cls) {
+            size_class& sc = _classes[cls - 1];
+            auto cell = static_cast<free_cell *>(memory);
+
+            spinlock::guard g(sc.lock);
+            cell->next = sc.free_list;
+            sc.free_list = cell;
+            --sc.in_use;
+        }
+
+        void release_memory(void *memory, uint8_t cls) {
+            cls ? deallocate(memory, cls) : ::operator delete(memory);
+        }
+
+        void* new_slab() {
+            void *slab = ::operator new(slab_size);
+            spinlock::guard g(_slabs_lock);
+            _slabs.push_back(slab);
+            return slab;
+        }
+
+        void u_release_slabs() {
+            for (auto slab : _slabs) {
+                ::operator delete(slab);
+            }
+            _slabs.clear();
+
+            for (auto& sc : _classes) {
+                sc.free_list = nullptr;
+                sc.bump = sc.bump_end = nullptr;
+                sc.in_use = 0;
+            }
+        }
+    };
+
+}
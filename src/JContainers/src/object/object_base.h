@@ -2,6 +2,8 @@
 
 #include <mutex>
 #include <atomic>
+#include <memory>
+#include <map>
 #include <assert.h>
 #include <boost/optional/optional.hpp>
 #include "boost/noncopyable.hpp"
@@ -9,6 +11,7 @@
 #include "intrusive_ptr.hpp"
 #include "util/spinlock.h"
 #include "util/istring.h"
+#include "object/stack_ref_batch.h"
 
 namespace collections {
 
@@ -38,6 +41,75 @@ namespace collections {
     using object_stack_ref_template = boost::intrusive_ptr_jc<T, object_base_stack_ref_policy>;
 	using object_stack_ref = object_stack_ref_template<object_base>;
 	using spinlock = util::spinlock;
+	using counted_spinlock = util::counted_spinlock;
+	using rw_spinlock = util::rw_spinlock;
+
+    // A bit-field of the packed reference counter word, see object_base::_refs
+    template<uint32_t Shift, uint32_t Bits>
+    struct ref_field {
+        static const uint64_t unit = uint64_t(1) << Shift;
+        static const uint64_t mask = ((uint64_t(1) << Bits) - 1) << Shift;
+        static const int32_t max = (int32_t(1) << Bits) - 1;
+
+        static int32_t get(uint64_t word) { return static_cast<int32_t>((word & mask) >> Shift); }
+    };
+
+    namespace refs {
+        using object = ref_field<0, 26>;    // owned by other objects
+        using tes = ref_field<26, 17>;      // retained by a user (Papyrus)
+        using stack = ref_field<43, 17>;    // referenced by Lua or C++ stack
+        using aqueue = ref_field<60, 4>;    // owned by the autorelease_queue
+
+        static_assert((object::mask | tes::mask | stack::mask | aqueue::mask) == ~uint64_t(0)
+            && object::mask + tes::mask + stack::mask + aqueue::mask == ~uint64_t(0),
+            "reference counter fields must fill the word without overlapping");
+    }
+
+    // The references beyond the capacity of a saturated counter field. A field stays at its max while
+    // the object has references counted here. Every transition of a saturated field takes the lock, the rest never do
+    class ref_overflow : boost::noncopyable {
+        spinlock _lock;
+        std::map<std::pair<const object_base *, uint64_t>, uint64_t> _counts; // (object, field's unit) -> references beyond max
+
+    public:
+
+        static ref_overflow& instance() {
+            static ref_overflow table;
+            return table;
+        }
+
+        spinlock& lock() { return _lock; }
+
+        // true if the object had no references beyond the field's max before
+        bool u_add(const object_base& obj, uint64_t unit, uint64_t count) {
+            auto& counted = _counts[std::make_pair(&obj, unit)];
+            counted += count;
+            return counted == count;
+        }
+
+        // false if there are no references beyond the field's max
+        bool u_take(const object_base& obj, uint64_t unit) {
+            auto itr = _counts.find(std::make_pair(&obj, unit));
+            if (itr == _counts.end()) {
+                return false;
+            }
+            if (--itr->second == 0) {
+                _counts.erase(itr);
+            }
+            return true;
+        }
+
+        uint64_t u_count(const object_base& obj, uint64_t unit) const {
+            auto itr = _counts.find(std::make_pair(&obj, unit));
+            return itr != _counts.end() ? itr->second : 0;
+        }
+
+        void forget(const object_base& obj) {
+            spinlock::guard g(_lock);
+            _counts.erase(_counts.lower_bound(std::make_pair(&obj, uint64_t(0))),
+                _counts.upper_bound(std::make_pair(&obj, ~uint64_t(0))));
+        }
+    };
 
     class object_base : public boost::noncopyable
     {
@@ -45,40 +117,106 @@ namespace collections {
         //object_base& operator=(const object_base&);
 
         friend class object_context;
+        friend class object_allocator;
     public:
         typedef uint32_t time_point;
 
     public:
         std::atomic<Handle> _id                 = Handle::Null;
-
-        std::atomic_int32_t _refCount           = 0;
-        std::atomic_int32_t _tes_refCount       = 0;
-        std::atomic_int32_t _stack_refCount     = 0;
-        std::atomic_int32_t _aqueue_refCount    = 0;
-        time_point _aqueue_push_time            = 0;
+        uint32_t _slot                          = 0; // object_registry's slot, 0 if not registered
+
+        // all four reference counters in one word (see refs namespace), so that an ownership check
+        // is a single load and a transition is a single atomic add or CAS
+        std::atomic<uint64_t> _refs             = 0;
+        // the aqueue bookkeeping stays inline: every new object passes through the queue
+        std::atomic<time_point> _aqueue_push_time = 0;
+        std::atomic<uint32_t> _gc_mark          = 0; // garbage_collector's mark, see garbage_collector.h
+        // changes each time the object gets exclusively locked, i.e. may have been modified.
+        // The high half is unique per object - a version never repeats at the same address
+        mutable std::atomic<uint64_t> _version;
 
         CollectionType                          _type = CollectionType::None;
-        util::istring                           _tag;
+        uint8_t _aqueue_bucket                  = 0; // aqueue's timer wheel bucket the object sits in
     private:
+        // object_allocator's size class the object's memory belongs to, 0 - the general heap
+        uint8_t _slab_class                     = 0;
         object_context *_context                = nullptr;
 
-        void release_counter(std::atomic_int32_t& counter);
+        // the fields few objects ever need. Allocated on demand, guarded by _mutex
+        struct extension {
+            util::istring tag;
+        };
+        std::unique_ptr<extension> _extension;
+
         bool is_completely_initialized() const { return _context != nullptr; }
         void try_prolong_lifetime();
 
+        // the size class of the memory the object is being constructed in, taken over by the constructor
+        static uint8_t& constructing_slab_class() {
+            static thread_local uint8_t cls = 0;
+            return cls;
+        }
+
+        static uint8_t take_constructing_slab_class() {
+            const uint8_t cls = constructing_slab_class();
+            constructing_slab_class() = 0;
+            return cls;
+        }
+
     public:
 
-        virtual ~object_base() {}
+        // boost.serialization creates loaded objects with 'new'. While an object_allocator::load_scope
+        // is active on the thread, their memory comes from the loading context's allocator as well
+        static void* operator new(size_t size);
+        static void operator delete(void *memory, size_t size);
+        static void* operator new(size_t, void *place) { return place; }
+        static void operator delete(void *, void *) {}
+
+        virtual ~object_base() {
+            const auto word = _refs.load(std::memory_order_relaxed);
+            if (refs::object::get(word) == refs::object::max || refs::tes::get(word) == refs::tes::max
+                || refs::stack::get(word) == refs::stack::max || refs::aqueue::get(word) == refs::aqueue::max)
+            {
+                ref_overflow::instance().forget(*this);
+            }
+        }
 
     public:
-        using lock = std::lock_guard<spinlock>;
-        mutable spinlock _mutex;
+        // exclusive access: the owner may modify the object, so the version gets bumped before the unlock -
+        // no writer can leave scalar_read_cache's entries valid
+        class lock {
+            const object_base& _object;
+        public:
+            explicit lock(const object_base& obj) : _object(obj) { obj._mutex.lock(); }
+            ~lock() {
+                _object.bump_version();
+                _object._mutex.unlock();
+            }
+            lock(const lock&) = delete;
+            lock& operator = (const lock&) = delete;
+        };
+        using shared_lock = rw_spinlock::shared_guard;
+        // exclusive for writers, shared for read-only accessors
+        mutable rw_spinlock _mutex;
+        // the object's index in the aqueue's bucket (see _aqueue_bucket). Next to _mutex, it takes the padding
+        // at the end of the object
+        uint32_t _aqueue_position               = 0;
 
         explicit object_base(CollectionType type)
-            : _type(type)
+            : _version(new_version_base())
+            , _type(type)
+            , _slab_class(take_constructing_slab_class())
         {
         }
 
+        static uint64_t new_version_base() {
+            static std::atomic<uint32_t> incarnations{ 0 };
+            return uint64_t(++incarnations) << 32;
+        }
+
+        uint64_t version() const { return _version.load(std::memory_order_acquire); }
+        void bump_version() const { _version.fetch_add(1, std::memory_order_release); }
+
         // for test purpose only!
         // registers (or returns already registered) identifier
 		// never prolongs lifetime (unlike @uid() func.)
@@ -92,7 +230,7 @@ namespace collections {
             return _uid() != Handle::Null;
         }
 
-        spinlock& mutex() const { return _mutex; }
+        rw_spinlock& mutex() const { return _mutex; }
 
         template<class T> T* as() {
             return const_cast<T*>(const_cast<const object_base*>(this)->as<T>());
@@ -116,45 +254,135 @@ namespace collections {
             return *casted_object;
         }
 
+        template<class Field> int32_t ref_count(std::memory_order order = std::memory_order_seq_cst) const {
+            return Field::get(_refs.load(order));
+        }
+
+        // the count including the references beyond a saturated field's max
+        template<class Field> uint64_t total_ref_count() const {
+            auto& overflow = ref_overflow::instance();
+            spinlock::guard g(overflow.lock());
+            const int32_t count = ref_count<Field>();
+            return count + (count == Field::max ? overflow.u_count(*this, Field::unit) : 0);
+        }
+
+        // raw counter increment - no write barrier. A counter that reaches its maximum saturates,
+        // the references beyond it get counted by ref_overflow instead of the carry spilling into the neighbouring counter
+        template<class Field> void add_ref() {
+            auto word = _refs.load(std::memory_order_relaxed);
+            for (;;) {
+                if (Field::get(word) == Field::max) {
+                    if (overflow_add<Field>()) {
+                        return;
+                    }
+                    word = _refs.load(std::memory_order_relaxed);
+                }
+                else if (_refs.compare_exchange_weak(word, word + Field::unit, std::memory_order_seq_cst)) {
+                    return;
+                }
+            }
+        }
+
+        // raw counter decrement, does nothing if the counter is zero already.
+        // Returns true if the reference was the last one the object had
+        template<class Field> bool drop_ref() {
+            auto word = _refs.load(std::memory_order_relaxed);
+            for (;;) {
+                if ((word & Field::mask) == 0) {
+                    return false;
+                }
+                if (Field::get(word) == Field::max) {
+                    if (overflow_drop<Field>()) {
+                        return false;
+                    }
+                    word = _refs.load(std::memory_order_relaxed);
+                }
+                else if (_refs.compare_exchange_weak(word, word - Field::unit, std::memory_order_seq_cst)) {
+                    return word == Field::unit;
+                }
+            }
+        }
+
+        // the increment of a saturated field. False if the field isn't saturated anymore
+        template<class Field> bool overflow_add(uint64_t count = 1) {
+            auto& overflow = ref_overflow::instance();
+            spinlock::guard g(overflow.lock());
+            if (ref_count<Field>() != Field::max) {
+                return false;
+            }
+            if (overflow.u_add(*this, Field::unit, count)) {
+                JC_log("object %u: the reference counter has exceeded %d, the excess is counted aside", HandleT(_uid()), Field::max);
+            }
+            return true;
+        }
+
+        // the decrement of a saturated field, never the last reference. False if the field isn't saturated anymore
+        template<class Field> bool overflow_drop() {
+            auto& overflow = ref_overflow::instance();
+            spinlock::guard g(overflow.lock());
+            auto word = _refs.load(std::memory_order_relaxed);
+            if (Field::get(word) != Field::max) {
+                return false;
+            }
+            if (!overflow.u_take(*this, Field::unit)) {
+                // nothing beyond max - the field leaves the saturation. The other fields may change meanwhile
+                while (!_refs.compare_exchange_weak(word, word - Field::unit, std::memory_order_seq_cst)) {}
+            }
+            return true;
+        }
+
         object_base * retain() {
-            ++_refCount;
+            add_ref<refs::object>();
+            write_barrier();
             return this;
         }
 
         object_base * tes_retain();
 
         int32_t refCount() const {
-            return _refCount + _tes_refCount + _stack_refCount + _aqueue_refCount;
+            auto word = _refs.load();
+            return refs::object::get(word) + refs::tes::get(word) + refs::stack::get(word) + refs::aqueue::get(word);
         }
         bool noOwners() const {
-            return
-                _refCount.load() <= 0 &&
-                _tes_refCount.load() <= 0 &&
-                _aqueue_refCount.load() <= 0 &&
-                _stack_refCount.load() <= 0;
+            return _refs.load() == 0;
         }
 
         bool u_is_user_retains() const {
-            return _tes_refCount.load(std::memory_order_relaxed) > 0;
+            return ref_count<refs::tes>(std::memory_order_relaxed) > 0;
         }
         bool is_in_aqueue() const {
-            return _aqueue_refCount.load(std::memory_order_relaxed) > 0;
+            return ref_count<refs::aqueue>(std::memory_order_relaxed) > 0;
         }
 
+        // lets the garbage collector know that the object has got a new owner
+        void write_barrier();
+
         // push the object into the queue (which will own it temporarily)
         object_base * prolong_lifetime();
         object_base * zero_lifetime();
 
         void release();
         void tes_release();
-        void stack_retain() { ++_stack_refCount; }
+        void stack_retain() { add_ref<refs::stack>(); write_barrier(); }
         void stack_release();
 
         // releases and then deletes object if no owners
         // true, if object deleted
-        void _aqueue_retain() { ++_aqueue_refCount; }
+        void _aqueue_retain() { add_ref<refs::aqueue>(); write_barrier(); }
+        // same as above, unless the object is in the queue already. True if retained
+        bool _aqueue_try_retain() {
+            auto word = _refs.load(std::memory_order_relaxed);
+            do {
+                if (refs::aqueue::get(word) != 0) {
+                    return false;
+                }
+            } while (!_refs.compare_exchange_weak(word, word + refs::aqueue::unit, std::memory_order_seq_cst));
+            write_barrier();
+            return true;
+        }
         bool _aqueue_release();
-        void _delete_self();
+        // false, if a concurrent getObjectRef has retained the object in the meantime
+        bool _delete_self();
 
         void set_context(object_context & ctx) {
             jc_assert(!_context);
@@ -176,29 +404,39 @@ namespace collections {
         // release calls and resulting deadlock
         virtual void u_nullifyObjects() = 0;
 
+        // moves the object's items out, the object becomes empty. Releasing the result destroys the items
+        virtual std::shared_ptr<void> u_detach_contents() = 0;
+
         SInt32 s_count() const {
-            lock g(_mutex);
+            shared_lock g(_mutex);
             return u_count();
         }
 
         void s_clear() {
-            lock g(_mutex);
+            lock g(*this);
             u_clear();
         }
 
-        void set_tag (const char* tag)
+        void set_tag (const char* tag);
+
+        util::istring tag () const
         {
-            lock g (_mutex);
-            if (tag) _tag = tag;
-            else _tag.clear ();
+            shared_lock g (_mutex);
+            return _extension ? _extension->tag : util::istring();
+        }
+
+        // the tag, if any. Not synchronized: for an object nobody else can access
+        const util::istring* u_tag () const
+        {
+            return _extension && !_extension->tag.empty() ? &_extension->tag : nullptr;
         }
 
         bool has_equal_tag (char const* tag) const
         {
             if (tag)
             {
-                lock g (_mutex);
-                return _tag == tag;
+                shared_lock g (_mutex);
+                return _extension ? _extension->tag == tag : *tag == '\0';
             }
             return false;
         }
@@ -207,11 +445,17 @@ namespace collections {
     };
 
     inline void object_base_stack_ref_policy::retain(object_base * p) {
-        p->stack_retain();
+        auto batch = stack_ref_batch::current();
+        if (!batch || !batch->retain(*p)) {
+            p->stack_retain();
+        }
     }
 
     inline void object_base_stack_ref_policy::release(object_base * p) {
-        p->stack_release();
+        auto batch = stack_ref_batch::current();
+        if (!batch || !batch->release(*p)) {
+            p->stack_release();
+        }
     }
 
     struct internal_object_lifetime_policy {
@@ -230,10 +474,21 @@ namespace collections {
     class object_lock {
         object_base::lock _lock;
     public:
-        explicit object_lock(const object_base *obj) : _lock(obj->_mutex) {}
-        explicit object_lock(const object_base &obj) : _lock(obj._mutex) {}
+        explicit object_lock(const object_base *obj) : _lock(*obj) {}
+        explicit object_lock(const object_base &obj) : _lock(obj) {}
+
+        template<class T, class P>
+        explicit object_lock(const boost::intrusive_ptr_jc<T, P>& ref) : _lock(static_cast<const object_base&>(*ref)) {}
+    };
+
+    // for read-only access: readers of the same object don't wait for each other
+    class object_shared_lock {
+        object_base::shared_lock _lock;
+    public:
+        explicit object_shared_lock(const object_base *obj) : _lock(obj->_mutex) {}
+        explicit object_shared_lock(const object_base &obj) : _lock(obj._mutex) {}
 
         template<class T, class P>
-        explicit object_lock(const boost::intrusive_ptr_jc<T, P>& ref) : _lock(static_cast<const object_base&>(*ref)._mutex) {}
+        explicit object_shared_lock(const boost::intrusive_ptr_jc<T, P>& ref) : _lock(static_cast<const object_base&>(*ref)._mutex) {}
     };
 }
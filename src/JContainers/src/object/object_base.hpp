@@ -1,7 +1,86 @@
 namespace collections
 {
+    namespace {
+
+        // Private objects which have lost their last owner while the owner was being deleted.
+        // They get deleted in the same pass instead of going through the aqueue one level at a time
+        struct deletion_cascade {
+            std::vector<object_base *> objects;
+
+            // the cascade of the deletion in progress on the current thread, if any
+            static deletion_cascade*& current() {
+                static thread_local deletion_cascade *cascade = nullptr;
+                return cascade;
+            }
+        };
+
+        // runs @destroy, then deletes the private objects which have lost their last owner because of it
+        template<class Destroy>
+        void destroy_with_orphans(Destroy&& destroy) {
+            auto& cascade = deletion_cascade::current();
+            if (cascade) { // a part of a cascade, the outermost deletion takes care of the orphans
+                destroy();
+                return;
+            }
+
+            deletion_cascade orphans;
+            cascade = &orphans;
+
+            destroy();
+
+            while (!orphans.objects.empty()) {
+                auto orphan = orphans.objects.back();
+                orphans.objects.pop_back();
+                // the orphan still can be retained by someone else in the meantime
+                if (orphan->noOwners()) {
+                    orphan->_delete_self();
+                }
+            }
+
+            cascade = nullptr;
+        }
+    }
+
+    void* object_base::operator new(size_t size) {
+        uint8_t cls = 0;
+        auto allocator = object_allocator::current_loading();
+        void *memory = allocator ? allocator->allocate_loaded(size, cls) : ::operator new(size);
+        constructing_slab_class() = cls;
+        return memory;
+    }
+
+    void object_base::operator delete(void *memory, size_t size) {
+        // object_allocator destroys the objects itself. The operator is reached when a constructor throws
+        // or boost.serialization drops the objects of a failed load
+        auto allocator = object_allocator::current_loading();
+        allocator ? allocator->deallocate_loaded(memory, size) : ::operator delete(memory);
+    }
+
     void object_base::_registerSelf() {
-        context().registry->registerNewObject(*this);
+        auto& ctx = context();
+        _gc_mark.store(ctx.gc->birth_mark(), std::memory_order_relaxed);
+        ctx.registry->registerNewObject(*this);
+    }
+
+    void object_base::write_barrier() {
+        if (_context) { // the object can be retained during loading
+            _context->gc->write_barrier(*this);
+        }
+    }
+
+    void object_base::set_tag(const char* tag) {
+        lock g(*this);
+
+        if (tag && *tag) {
+            if (!_extension) _extension.reset(new extension());
+            _extension->tag = tag;
+        }
+        else _extension.reset();
+
+        // a loaded object gets indexed once it's placed into the registry, the registry checks that under its index lock
+        if (_context) {
+            context().registry->retag(*this, _extension ? _extension->tag : util::istring());
+        }
     }
 
     Handle object_base::public_id() {
@@ -50,7 +129,7 @@ namespace collections
                 id = context().registry->registerNewObjectId(*this);
                 _id.store(id, memory_order_release);
                 
-                if (!_refCount) {
+                if (ref_count<refs::object>() == 0) {
                     // prolong_lifetime if the object is not referenced by another objects -> should be done,
                     // as we must ensure that not-owned object will not hang forever
                     prolong_lifetime();
@@ -63,66 +142,104 @@ namespace collections
     }
 
 	// AQueue is the only caller of the function. The function invoked when the object's lifetime expires.
-    // Decreases _aqueue_refCount OR deletes the object if AQueue is the only owner of the object
+    // Decreases the aqueue counter OR deletes the object if AQueue is the only owner of the object
     // Returns true, if object deleted
     bool object_base::_aqueue_release() {
-        if (refCount() <= 1) {
-            _aqueue_refCount = 0;
-            _delete_self();
-            return true;
-        }
-        else {
-            --_aqueue_refCount;
+        if (drop_ref<refs::aqueue>()) {
+            return _delete_self();
         }
-
         return false;
     }
 
-    void object_base::_delete_self() {
-        // it's still possible that something will attepmt to access this object now?
-        context().registry->removeObject(*this);
-        delete this;
+    bool object_base::_delete_self() {
+        auto& ctx = context();
+        if (!ctx.registry->removeObject(*this)) {
+            // a lock-free reader has retained the object just now. Give it one more lifetime,
+            // the aqueue will decide its fate later
+            prolong_lifetime();
+            return false;
+        }
+
+        if (ctx.deferred->should_defer(*this)) {
+            // the object is unreachable already, its items get destroyed on the worker pool
+            ctx.deferred->submit([contents = u_detach_contents()]() mutable {
+                destroy_with_orphans([&contents]() { contents.reset(); });
+            });
+        }
+
+        // lock-free readers may still access the object's memory - the allocator releases it later
+        destroy_with_orphans([this, &ctx]() { ctx.allocator->destroy(this); });
+        return true;
     }
 
     object_base* object_base::tes_retain() {
-        ++_tes_refCount;
+        add_ref<refs::tes>();
+        write_barrier();
         context().aqueue->not_prolong_lifetime(*this);
         return this;
     }
 
     void object_base::tes_release() {
-        if (_tes_refCount > 0) {
-            --_tes_refCount;
-            if (noOwners()) {
-                // a user releases the object, no owners - I may even delete it immediately
-                context().aqueue->prolong_lifetime(*this, true);
-            }
+        if (drop_ref<refs::tes>()) {
+            // a user releases the object, no owners - I may even delete it immediately
+            context().aqueue->prolong_lifetime(*this, true);
         }
     }
 
     void object_base::stack_release() {
-        if (_stack_refCount > 0) {
-            --_stack_refCount;
-            if (noOwners()) {
-                // the object no more referenced by Lua or stack, no owners - I may even delete it immediately
-                // (immediately if the object is not exposed to Skyrim, i.e. has no public ID)
-                prolong_lifetime();
+        for (;;) {
+            auto word = _refs.load(std::memory_order_relaxed);
+            do {
+                if (refs::stack::get(word) == refs::stack::max && overflow_drop<refs::stack>()) {
+                    return;
+                }
+                if (refs::stack::get(word) == 0) {
+                    break;
+                }
+            } while (!_refs.compare_exchange_weak(word, word - refs::stack::unit, std::memory_order_seq_cst));
+
+            if (refs::stack::get(word) != 0) {
+                if (word == refs::stack::unit) {
+                    // the object no more referenced by Lua or stack, no owners - I may even delete it immediately
+                    // (immediately if the object is not exposed to Skyrim, i.e. has no public ID)
+                    prolong_lifetime();
+                }
+                return;
+            }
+
+            // the reference has been counted by a stack_ref_batch of another thread only
+            switch (hazard_table::instance().take_reference(*this)) {
+            case hazard_table::take_result::taken:
+                return;
+            case hazard_table::take_result::closing:
+                std::this_thread::yield();
+                break;
+            case hazard_table::take_result::absent:
+                // a batch counts its references before leaving the slot. Nothing counted - an excess release
+                if (ref_count<refs::stack>() == 0) {
+                    return;
+                }
+                break;
             }
         }
     }
 
     void object_base::release() {
         // an object can be simultaneously released in diff. threads twice (example - tes_context.setDatabase) -- assertion disabled:
-        //jc_assert(_refCount > 0);
+        //jc_assert(ref_count<refs::object>() > 0);
 
-        if (_refCount > 0) {
-            --_refCount;
-            if (noOwners()) {
-                // the object get's erased from another object, no owners - I may even delete it immediately
-                // (immediately if the object is not exposed to Skyrim, i.e. has no public ID)
+        if (drop_ref<refs::object>()) {
+            // the object get's erased from another object, no owners - I may even delete it immediately
+            // (immediately if the object is not exposed to Skyrim, i.e. has no public ID)
 
-                // Note that this function sometimes being called during loading (deserialization)
-                // We can't delete objects during loading even if noOwners() is true - more owners may be loaded later
+            // Note that this function sometimes being called during loading (deserialization)
+            // We can't delete objects during loading even if noOwners() is true - more owners may be loaded later
+            auto cascade = deletion_cascade::current();
+            if (cascade && !is_public()) {
+                // the owner is being deleted and nobody knows the object's handle
+                cascade->objects.push_back(this);
+            }
+            else {
                 try_prolong_lifetime();
             }
         }
@@ -138,13 +255,85 @@ namespace collections
         }
     }
 
+    bool stack_ref_batch::retain(object_base& obj) {
+        auto idx = find(obj);
+        if (idx >= 0) {
+            add_balance(idx, 1);
+            return true;
+        }
+        if (publish(obj, 1) < 0) {
+            return false;
+        }
+        // the object has got a new owner, as far as the garbage collector is concerned
+        obj.write_barrier();
+        return true;
+    }
+
+    void stack_ref_batch::cancel_lookup(object_base& obj) {
+        jc_assert(find(obj) >= 0);
+        if (_lookup_published) {
+            // the object may be gone once the lookup ends, the slot must not outlive it
+            jc_assert(_record->slots[_used - 1].load(std::memory_order_relaxed) == &obj);
+            const int32_t balance = close_balance(_used - 1);
+            _record->slots[--_used].store(nullptr, std::memory_order_release);
+            _lookup_published = false;
+            // another thread has taken references counted elsewhere out of the balance - they get released for real
+            for (int32_t i = balance; i < 1; ++i) {
+                obj.stack_release();
+            }
+        }
+        else {
+            add_balance(find(obj), -1);
+        }
+    }
+
+    stack_ref_batch::~stack_ref_batch() {
+        if (!_active) {
+            return;
+        }
+        // the references get applied for real from now on
+        current_ref() = nullptr;
+
+        for (uint32_t i = _used; i-- > 0;) {
+            auto& slot = _record->slots[i];
+            object_base *obj = slot.load(std::memory_order_relaxed);
+            // the other threads can't take references out of the balance anymore
+            int32_t balance = close_balance(i);
+
+            if (balance > 0) { // the references outlive the call
+                for (; balance > 0; --balance) {
+                    obj->add_ref<refs::stack>();
+                }
+                slot.store(nullptr, std::memory_order_release);
+            }
+            else if (balance == 0) {
+                if (obj->noOwners()) {
+                    // the object has lost its owners during the call - it gets the lifetime stack_release would give it
+                    obj->add_ref<refs::stack>();
+                    slot.store(nullptr, std::memory_order_release);
+                    obj->stack_release();
+                }
+                else {
+                    slot.store(nullptr, std::memory_order_release);
+                }
+            }
+            else { // the call has released references taken before it
+                slot.store(nullptr, std::memory_order_release);
+                for (; balance < 0; ++balance) {
+                    obj->stack_release();
+                }
+            }
+        }
+        _used = 0;
+    }
+
     object_base* object_base::prolong_lifetime() {
         context().aqueue->prolong_lifetime(*this, is_public());
         return this;
     }
 
     object_base* object_base::zero_lifetime() {
-        context().aqueue->not_prolong_lifetime(*this);
+        context().aqueue->zero_lifetime(*this);
         return this;
     }
 }
\ No newline at end of file
@@ -15,26 +15,31 @@ namespace boost { namespace serialization {
     void save(Archive & ar, const cl::object_base & t, unsigned int version) {
         //jc_assert(version == 1);
 
-        // Lua retains an objects with _stack_refCount counter. Asertion disabled 
-        //jc_assert(t._stack_refCount.load(std::memory_order_relaxed) == 0);
+        // Lua retains an objects with the stack counter. Asertion disabled 
+        //jc_assert(t.ref_count<cl::refs::stack>(std::memory_order_relaxed) == 0);
         jc_assert(t.noOwners() == false);
 
         switch (version) {
         case 2:
-            ar << t._aqueue_push_time;
+            save_atomic(ar, t._aqueue_push_time);
             break;
-        case 1:
-            save_atomic(ar, t._refCount); // may not store it in v2.0 anymore
+        case 1: {
+            int32_t refCount = t.ref_count<cl::refs::object>(std::memory_order_relaxed); // may not store it in v2.0 anymore
+            ar << refCount;
             break;
+        }
         case 0:
         default:
             jc_assert(false);
             break;
         }
 
-        save_atomic(ar, t._tes_refCount);
+        const int32_t tes_refCount = static_cast<int32_t>((std::min)(t.total_ref_count<cl::refs::tes>(), uint64_t((std::numeric_limits<int32_t>::max)())));
+        ar << tes_refCount;
         save_atomic(ar, t._id);
-        ar << *reinterpret_cast<std::string const*> (&t._tag); //force Boost detection
+        const auto tag = t.tag();
+        const std::string tag_string(tag.data(), tag.size());
+        ar << tag_string;
     }
 
     template<class Archive>
@@ -47,17 +52,22 @@ namespace boost { namespace serialization {
             break;
         }
         case 2:
-            ar >> t._aqueue_push_time;
+            load_atomic(ar, t._aqueue_push_time);
             break;
         }
 
-        load_atomic(ar, t._tes_refCount);
+        int32_t tes_refCount = 0;
+        ar >> tes_refCount;
 
         switch (version) {
         case 2:
         case 1:
             load_atomic (ar, t._id);
-            ar >> *reinterpret_cast<std::string*> (&t._tag); //force Boost detection
+            {
+                std::string tag;
+                ar >> tag;
+                t.set_tag(tag.c_str());
+            }
             break;
         case 0:
             ar >> t._type;
@@ -68,8 +78,17 @@ namespace boost { namespace serialization {
             break;
         }
 
+        // other objects may have retained the object already - the rest of the counters stay intact.
+        // The count beyond the field's capacity goes aside
+        tes_refCount = (std::max)(0, tes_refCount);
+        const int32_t packed = (std::min)(tes_refCount, int32_t(cl::refs::tes::max));
+        t._refs.fetch_add(cl::refs::tes::unit * static_cast<uint64_t>(packed), std::memory_order_relaxed);
+        if (tes_refCount > packed) {
+            t.overflow_add<cl::refs::tes>(tes_refCount - packed);
+        }
+
         // "trying detect objects with no owners" - not possible to do this assertion anymore:
-        // Lua retains an objects with _stack_refCount counter. Asertion disabled 
+        // Lua retains an objects with the stack counter. Asertion disabled 
         //jc_assert(version == 0 || t.noOwners() == false);
     }
 
@@ -2,6 +2,7 @@
 
 #include <atomic>
 #include <functional>
+#include <chrono>
 #include <deque>
 #include <boost/serialization/split_member.hpp>
 
@@ -18,6 +19,9 @@ namespace collections {
 
     class object_registry;
     class autorelease_queue;
+    class object_allocator;
+    class garbage_collector;
+    class deferred_destruction;
 
 
     class dependent_context {
@@ -52,9 +56,22 @@ namespace collections {
         void u_postLoadMaintenance(const serialization_version saveVersion);
         void u_print_stats() const;
 
+        // contention of the context's shared locks. Object locks are accounted in @all_locks only
+        struct lock_stats {
+            util::lock_contention all_locks;    // all locks of the process, object ones included
+            util::lock_contention aqueue;
+            util::lock_contention garbage_collector;
+            util::lock_contention dependent_contexts;
+        };
+        lock_stats get_lock_stats() const;
+
     public:
+        // declared first to outlive everything allocated from it
+        std::unique_ptr<object_allocator> allocator;
         std::unique_ptr<object_registry> registry;
         std::unique_ptr<autorelease_queue> aqueue;
+        std::unique_ptr<deferred_destruction> deferred;
+        std::unique_ptr<garbage_collector> gc;
 
     public:
 
@@ -62,6 +79,7 @@ namespace collections {
         virtual ~object_context();
 
         std::vector<object_stack_ref> filter_objects(std::function<bool(object_base& obj)> predicate) const;
+        std::vector<object_stack_ref> tagged_objects(const char *tag) const;
 
         template<class T>
         T * getObjectOfType(Handle hdl) {
@@ -81,6 +99,10 @@ namespace collections {
 
         // exposed for testing purposes only
         size_t collect_garbage();
+
+        // requests an incremental collection, which runs on the background worker.
+        // Each slice of the collection lasts about @slice_budget
+        void request_garbage_collection(std::chrono::milliseconds slice_budget);
     public:
 
         // stops object_context's activity, until destroyed and then restarts it 
@@ -107,7 +129,7 @@ namespace collections {
         BOOST_SERIALIZATION_SPLIT_MEMBER();
 
     private:
-        spinlock _dependent_contexts_mutex;
+        counted_spinlock _dependent_contexts_mutex;
         std::vector<dependent_context*> _dependent_contexts;
 
     public:
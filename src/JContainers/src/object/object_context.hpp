@@ -4,11 +4,16 @@ namespace collections
 {
     object_context::object_context()
     {
-        registry.reset(new object_registry{});
+        allocator.reset(new object_allocator{});
+        registry.reset(new object_registry{ allocator->epoch() });
         aqueue.reset(new autorelease_queue{ *registry });
+        deferred.reset(new deferred_destruction{});
+        gc.reset(new garbage_collector{ *registry, *deferred });
     }
 
     object_context::~object_context() {
+        // the jobs still may use the rest of the context
+        deferred->wait_idle();
     }
 
     object_context::activity_stopper::activity_stopper(object_context& c)
@@ -22,43 +27,42 @@ namespace collections
     }
 
     void object_context::stop_activity() {
+        gc->stop();
         aqueue->stop();
+        // the contents of the deleted containers are gone once the activity is stopped
+        deferred->wait_idle();
     }
 
     void object_context::start_activity() {
         aqueue->start();
+        gc->start();
     }
     
     void object_context::u_clearState() {
         {
-            spinlock::guard g(_dependent_contexts_mutex);
+            counted_spinlock::guard g(_dependent_contexts_mutex);
             for (auto& ctx : _dependent_contexts) {
                 ctx->clear_state();
             }
         }
 
-        /*  Not good, but working solution.
-
-        purpose: free allocated memory
-        problem: a regular delete call won't help as the delete will access memory of possible deleted objects
-
-        solution: isolate the objects by nullifying cross-references, then delete the objects
-
-        actually all I need is just free all allocated memory, but this is hardly achievable
-
+        /*  Each object is isolated (its cross-references get nullified without a release call, as the referenced
+            objects may be destroyed already) and destroyed in one walk. The objects' memory is released in bulk
+            by dropping the allocator's slabs. The item storage is freed by the destructors
         */
         {
+            deferred->wait_idle();
+            gc->u_abort();
             aqueue->u_nullify();
 
             for (auto& obj : registry->u_all_objects()) {
                 obj->u_nullifyObjects();
-            }
-            for (auto& obj : registry->u_all_objects()) {
-                delete obj;
+                allocator->u_destroy_in_bulk(obj);
             }
 
             registry->u_clear();
             aqueue->u_clear();
+            allocator->u_release_all();
         }
     }
 
@@ -66,6 +70,10 @@ namespace collections
         return registry->filter_objects(predicate);
     }
 
+    std::vector<object_stack_ref> object_context::tagged_objects(const char *tag) const {
+        return registry->tagged_objects(tag);
+    }
+
     object_base * object_context::getObject(Handle hdl) {
         return registry->getObject(hdl);
     }
@@ -88,14 +96,19 @@ namespace collections
 
     size_t object_context::collect_garbage() {
         activity_stopper s{ *this };
-        auto res = garbage_collector::u_collect(*registry, *aqueue);
+        auto res = gc->u_collect();
         return res.garbage_total;
     }
 
+    void object_context::request_garbage_collection(std::chrono::milliseconds slice_budget) {
+        gc->request(slice_budget);
+    }
+
     //////////////////////////////////////////////////////////////////////////
 
     template<>
     void object_context::load(boost::archive::binary_iarchive & ar, unsigned int version) {
+        object_allocator::load_scope scope{ *allocator };
         ar >> *registry >> *aqueue;
     }
 
@@ -106,6 +119,7 @@ namespace collections
 
     template<>
     void object_context::load_data_in_old_way(boost::archive::binary_iarchive& ar) {
+        object_allocator::load_scope scope{ *allocator };
         ar >> *registry >> *aqueue;
     }
 
@@ -113,6 +127,33 @@ namespace collections
         JC_log("%lu objects total", registry->u_all_objects().size());
         JC_log("%lu public objects", registry->u_public_object_count());
         JC_log("%lu objects in aqueue", aqueue->u_count());
+
+        auto alloc = allocator->get_stats();
+        JC_log("%lu KB reserved by object allocator, %lu KB used", alloc.reserved_bytes / 1024, alloc.used_bytes / 1024);
+
+        auto locks = get_lock_stats();
+        JC_log("lock contention: %llu contended acquisitions, %llu pauses, %llu parks (aqueue %llu, gc %llu)",
+            locks.all_locks.contended, locks.all_locks.spins, locks.all_locks.parks,
+            locks.aqueue.contended, locks.garbage_collector.contended);
+
+        auto destruction = deferred->get_stats();
+        JC_log("deferred destruction: %llu containers destroyed on the worker pool, %llu jobs pending",
+            destruction.detached, destruction.pending);
+
+        auto workers = util::background_workers().get_stats();
+        const uint64_t jobs = (std::max)(workers.jobs_done, uint64_t(1));
+        JC_log("worker pool: %u threads, %llu jobs queued, %llu done; wait %llu us on average (max %llu us), run %llu us on average (max %llu us)",
+            workers.thread_count, workers.queue_depth, workers.jobs_done,
+            workers.total_wait_us / jobs, workers.max_wait_us, workers.total_run_us / jobs, workers.max_run_us);
+    }
+
+    object_context::lock_stats object_context::get_lock_stats() const {
+        lock_stats st;
+        st.all_locks = util::global_lock_contention();
+        st.aqueue = aqueue->lock_contention();
+        st.garbage_collector = gc->lock_contention();
+        st.dependent_contexts = _dependent_contexts_mutex.contention();
+        return st;
     }
 
     //////////////////////////////////////////////////////////////////////////
@@ -128,21 +169,19 @@ namespace collections
 
     void object_context::u_postLoadMaintenance(const serialization_version saveVersion)
     {
-        util::do_with_timing("Garbage collection", [&]() {
-            auto res = garbage_collector::u_collect(*registry, *aqueue);
-            JC_log("%u garbage objects collected. %u objects are parts of cyclic graphs", res.garbage_total, res.part_of_graphs);
-        });
+        // the collection starts on the background worker once the activity resumes
+        gc->request();
     }
 
     void object_context::add_dependent_context(dependent_context& ctx) {
-        spinlock::guard g(_dependent_contexts_mutex);
+        counted_spinlock::guard g(_dependent_contexts_mutex);
         if (std::find(_dependent_contexts.begin(), _dependent_contexts.end(), &ctx) == _dependent_contexts.end()) {
             _dependent_contexts.push_back(&ctx);
         }
     }
 
     void object_context::remove_dependent_context(dependent_context& ctx) {
-        spinlock::guard g(_dependent_contexts_mutex);
+        counted_spinlock::guard g(_dependent_contexts_mutex);
         _dependent_contexts.erase(std::remove(_dependent_contexts.begin(), _dependent_contexts.end(), &ctx), _dependent_contexts.end());
     }
 
@@ -40,9 +40,12 @@
 
 #include "object_base_serialization.h"
 
+#include "object_allocator.h"
 #include "id_generator.h"
+#include "tag_index.h"
 #include "object_registry.h"
 #include "autorelease_queue.h"
+#include "deferred_destruction.h"
 #include "garbage_collector.h"
 
 #include "object_base.hpp"
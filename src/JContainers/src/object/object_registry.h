@@ -3,73 +3,311 @@
 
 namespace collections
 {
+    // A public handle encodes an index into the registry's slot table in its lower bits
+    // and the slot's generation in the upper ones. Both are 31 bits in total, so that handles stay positive
+    struct handle_layout {
+        enum : uint32_t {
+            index_bits = 21,
+            generation_bits = 10,
+            index_mask = (1u << index_bits) - 1,
+            generation_mask = (1u << generation_bits) - 1,
+            retired_generation = generation_mask + 1,   // the slot has issued all the handles it can
+        };
+
+        static Handle make(uint32_t index, uint32_t generation) {
+            return Handle(((generation & generation_mask) << index_bits) | (index & index_mask));
+        }
+
+        static uint32_t index(Handle hdl) { return HandleT(hdl) & index_mask; }
+        static uint32_t generation(Handle hdl) { return (HandleT(hdl) >> index_bits) & generation_mask; }
+    };
+
+    typedef id_generator<HandleT, 1, handle_layout::index_mask> slot_id_generator;
+
+    // Each registered object occupies a slot of a dense, chunked slot table. Chunks never move, so
+    // a handle lookup is a bounds check plus a handle compare and takes no lock.
+    // A slot's generation is bumped each time the slot gets freed, which invalidates stale handles.
+    // Slot indices are handed out by id_generator, lowest free index first, so the table stays as large as
+    // the peak number of objects rather than the whole index space. A freed index spends a while in a small
+    // quarantine first. A slot which has issued all 2^generation_bits handles retires: it's never reused, so a stale
+    // handle never resolves to another object. The generations of the free slots are saved along with the objects.
+    // Thus the table holds up to 2^index_bits objects at once, and a slot issues up to 2^generation_bits handles
+    // over the whole life of a save
+    //
+    // getObjectRef retains the object it finds without a lock too. The memory of a deleted object is kept
+    // by object_allocator until the memory_epoch allows to release it, so a reader can safely bump the stack
+    // reference count of an object which is being deleted; the reader and the deleter then sort out who wins
+    // (see u_tryRetain and u_removeObject). An object held by a stack_ref_batch's hazard slot is never removed
+    //
+    // A new object takes no lock either: a thread reserves a block of slot indices at once and places
+    // its objects into them. The indices a thread hasn't used go back once the thread drops the reservation or exits
     class object_registry
     {
     public:
-        typedef std::unordered_set<object_base *> all_objects_set;
-        typedef std::unordered_map<Handle, object_base *> registry_container;
+
+        enum : uint32_t {
+            chunk_size = 4096,
+            max_chunks = (handle_layout::index_mask + 1) / chunk_size,
+            reservation_size = 32,      // slot indices a thread reserves at once
+            reservations_per_thread = 4,    // registries a thread keeps reservations for
+            quarantine_size = chunk_size,   // freed slot indices that wait before they get reused
+        };
+
+        struct slot {
+            std::atomic<object_base *> object = nullptr;  // null if the slot is free
+            std::atomic<Handle> handle = Handle::Null;    // Null until the object gets exposed
+            uint16_t generation = 0;                      // generation of the next handle issued by the slot or retired_generation
+        };
+
+        // the generation a free slot has, saved along with the objects
+        struct slot_generation {
+            uint32_t index = 0;
+            uint16_t generation = 0;
+
+            template<class Archive>
+            void serialize(Archive & ar, const unsigned int version) {
+                ar & index;
+                ar & generation;
+            }
+        };
+
+        // iterable range of all registered objects
+        class object_range {
+            const object_registry& _registry;
+
+        public:
+
+            class iterator {
+                const object_registry *_registry;
+                uint32_t _index;
+                object_base *_current;
+
+                // moves to the first occupied slot at or after the _index
+                void settle() {
+                    const uint32_t end = _registry->u_capacity();
+                    for (; _index < end; ++_index) {
+                        const slot *chunk = _registry->_chunks[_index / chunk_size].load(std::memory_order_acquire);
+                        if (!chunk) {
+                            _index = (_index / chunk_size + 1) * chunk_size - 1;
+                            continue;
+                        }
+
+                        _current = chunk[_index % chunk_size].object.load(std::memory_order_acquire);
+                        if (_current) {
+                            return;
+                        }
+                    }
+                    _index = end;
+                    _current = nullptr;
+                }
+
+            public:
+                typedef std::forward_iterator_tag iterator_category;
+                typedef object_base* value_type;
+                typedef ptrdiff_t difference_type;
+                typedef object_base* const* pointer;
+                typedef object_base* const& reference;
+
+                iterator(const object_registry& registry, uint32_t index) : _registry(&registry), _index(index), _current(nullptr) {
+                    settle();
+                }
+
+                reference operator * () const { return _current; }
+                pointer operator -> () const { return &_current; }
+
+                iterator& operator ++ () {
+                    ++_index;
+                    settle();
+                    return *this;
+                }
+
+                iterator operator ++ (int) {
+                    iterator prev = *this;
+                    ++*this;
+                    return prev;
+                }
+
+                bool operator == (const iterator& other) const { return _index == other._index; }
+                bool operator != (const iterator& other) const { return _index != other._index; }
+            };
+
+            explicit object_range(const object_registry& registry) : _registry(registry) {}
+
+            iterator begin() const { return iterator(_registry, 0); }
+            iterator end() const { return iterator(_registry, _registry.u_capacity()); }
+            size_t size() const { return _registry._object_count.load(std::memory_order_relaxed); }
+        };
 
     private:
 
         friend class object_context;
 
-        registry_container _map;
-        id_generator_type _idGen;
-        all_objects_set _all_objects;
+        std::atomic<slot *> _chunks[max_chunks];
+        std::atomic<uint32_t> _chunk_limit;     // index of the last allocated chunk + 1
+        slot_id_generator _idGen;
+        std::deque<uint32_t> _quarantine;   // freed slot indices, the oldest one first
+
+        // handles loaded from old saves, which can't be decoded into the index of the slot the object occupies
+        std::unordered_map<Handle, uint32_t> _legacy_handles;
+        std::atomic<bool> _has_legacy_handles;
+
+        std::atomic<uint32_t> _object_count;
+        std::atomic<uint32_t> _public_count;
+        memory_epoch& _epoch;
         mutable bshared_mutex _mutex;
+        tag_index _tags;
+
+        // The way back to the registry for the unused reserved indices. A thread may outlive the registry,
+        // so the registry detaches the owner when it dies or when its outstanding reservations become invalid
+        struct reservation_owner {
+            spinlock lock;
+            object_registry *registry;
+        };
+
+        // slot indices reserved by a thread, their slots are allocated already
+        struct reservation {
+            uint64_t tag = 0;   // _reservation_tag of the registry the indices belong to
+            std::weak_ptr<reservation_owner> owner;
+            uint32_t count = 0;
+            uint32_t indices[reservation_size];
+        };
+
+        // a thread's reservations, the most recently used one comes first
+        struct thread_reservations {
+            reservation items[reservations_per_thread];
+
+            ~thread_reservations() {
+                for (auto& reserved : items) {
+                    give_back(reserved);
+                }
+            }
+        };
+
+        // unique among all registries ever created, changes once the reservations of the registry get invalid
+        std::atomic<uint64_t> _reservation_tag;
+        std::shared_ptr<reservation_owner> _reservation_owner;
+
+        static uint64_t new_reservation_tag() {
+            static std::atomic<uint64_t> last_tag{ 0 };
+            return last_tag.fetch_add(1, std::memory_order_relaxed) + 1;
+        }
 
         object_registry(const object_registry& );
         object_registry& operator = (const object_registry& );
 
     public:
 
-        explicit object_registry()
-            : _mutex()
+        explicit object_registry(memory_epoch& epoch)
+            : _chunk_limit(0)
+            , _has_legacy_handles(false)
+            , _object_count(0)
+            , _public_count(0)
+            , _epoch(epoch)
+            , _mutex()
+            , _reservation_tag(new_reservation_tag())
+            , _reservation_owner(make_reservation_owner(*this))
         {
+            for (auto& chunk : _chunks) {
+                chunk.store(nullptr, std::memory_order_relaxed);
+            }
+        }
+
+        ~object_registry() {
+            u_detach_reservations();
+            u_release_chunks();
         }
 
         void registerNewObject(object_base& obj) {
-            write_lock g(_mutex);
-            auto itr = _all_objects.find(&obj);
-            jc_assert(itr == _all_objects.end());
-            _all_objects.insert(&obj);
+            auto& reserved = this_thread_reservation();
+            if (reserved.count == 0) {
+                u_reserve(reserved);
+            }
+            u_placeObject(obj, reserved.indices[--reserved.count]);
         }
 
         Handle registerNewObjectId(object_base& obj) {
             //jc_assert(obj._uid() == Handle::Null);
 
-            write_lock g(_mutex);
+            slot& s = *u_slot(obj._slot);
+            auto id = handle_layout::make(obj._slot, s.generation);
+
+            if (_has_legacy_handles.load(std::memory_order_acquire)) {
+                write_lock g(_mutex);
+                // the slot must never issue a handle that still identifies a loaded object
+                while (_legacy_handles.find(id) != _legacy_handles.end()) {
+                    s.generation = (s.generation + 1) & handle_layout::generation_mask;
+                    id = handle_layout::make(obj._slot, s.generation);
+                }
+            }
 
-            auto id = (Handle)_idGen.new_id();
-            jc_assert(_map.find(id) == _map.end());
-            _map.insert(registry_container::value_type(id, &obj));
+            s.handle.store(id, std::memory_order_release);
+            ++_public_count;
             return id;
         }
 
-        void removeObject(object_base& obj) {
+        // returns false if the object can't be removed as a lock-free reader has just retained it
+        bool removeObject(object_base& obj) {
             write_lock g(_mutex);
-            u_removeObject(obj);
+            return u_removeObject(obj);
         }
 
-        void u_removeObject(object_base& obj) {
-            auto id = obj._uid();
+        bool u_removeObject(object_base& obj) {
+            const uint32_t index = obj._slot;
+            slot& s = *u_slot(index);
+            jc_assert(s.object.load(std::memory_order_relaxed) == &obj);
+
+            auto id = s.handle.load(std::memory_order_relaxed);
             if (id != Handle::Null) {
-                _map.erase(id);
-                _idGen.reuse_id((HandleT)id);
+                // unpublish the handle first, then look whether a reader managed to retain the object
+                s.handle.store(Handle::Null, std::memory_order_seq_cst);
+                if (obj.ref_count<refs::stack>() != 0 || hazard_table::instance().is_protected(obj)) {
+                    s.handle.store(id, std::memory_order_seq_cst);
+                    return false;
+                }
+
+                if (handle_layout::index(id) != index) {
+                    _legacy_handles.erase(id);
+                    _has_legacy_handles.store(!_legacy_handles.empty(), std::memory_order_release);
+                }
+                else if (++s.generation > handle_layout::generation_mask) {
+                    s.generation = handle_layout::retired_generation;
+                }
+                --_public_count;
             }
+            else if (hazard_table::instance().is_protected(obj)) {
+                // a stack_ref_batch holds the object without counting it
+                return false;
+            }
+
+            // the object's tag may be changing right now, the index knows what to remove by itself
+            _tags.remove(obj, [&obj]() { obj._slot = 0; });
+
+            s.handle.store(Handle::Null, std::memory_order_release);
+            s.object.store(nullptr, std::memory_order_release);
 
-            auto itr = _all_objects.find(&obj);
-            jc_assert(itr != _all_objects.end());
-            _all_objects.erase(itr);
+            // a retired slot's index stays in use forever
+            if (s.generation != handle_layout::retired_generation) {
+                _quarantine.push_back(index);
+                if (_quarantine.size() > quarantine_size) {
+                    _idGen.reuse_id(_quarantine.front());
+                    _quarantine.pop_front();
+                }
+            }
+            --_object_count;
+            return true;
         }
 
         object_base *getObject(Handle hdl) const {
-            if (hdl == Handle::Null) {
-                return nullptr;
+            if (auto obj = u_findObject(hdl)) {
+                return obj;
+            }
+
+            if (_has_legacy_handles.load(std::memory_order_acquire)) {
+                read_lock g(_mutex);
+                return u_getLegacyObject(hdl);
             }
-            
-            read_lock g(_mutex);
-            return u_getObject(hdl);
+
+            return nullptr;
         }
 
         std::vector<object_stack_ref> filter_objects(std::function<bool(object_base& obj)>& predicate) const {
@@ -77,7 +315,7 @@ namespace collections
 
             std::vector<object_stack_ref> objects;
 
-            for (auto obj : _all_objects) {
+            for (auto obj : u_all_objects()) {
                 if (predicate(*obj)) {
                     objects.push_back(obj);
                 }
@@ -86,80 +324,399 @@ namespace collections
             return objects;
         }
 
+        // the objects tagged with @tag, costs as much as there are such objects
+        std::vector<object_stack_ref> tagged_objects(const char *tag) const {
+            // removeObject takes the write lock - none of the objects can disappear meanwhile
+            read_lock r(_mutex);
+
+            std::vector<object_stack_ref> objects;
+            _tags.for_each(tag, [&](object_base& obj) {
+                objects.push_back(&obj);
+            });
+
+            return objects;
+        }
+
+        // keeps the tag index up to date, called by object_base::set_tag. The object may be leaving the registry
+        // concurrently: u_removeObject zeroes its _slot under the index lock, such an object isn't indexed anymore
+        void retag(object_base& obj, const util::istring& current) {
+            _tags.retag(obj, current, [&obj]() { return obj._slot != 0; });
+        }
+
         object_stack_ref getObjectRef(Handle hdl) const {
-            // had to copy&paste getObject function as we really must own an object BEFORE read lock will be released
             if (hdl == Handle::Null) {
                 return nullptr;
             }
-            read_lock g(_mutex);
-            return u_getObject(hdl);
-        }
 
-        object_base *u_getObject(Handle hdl) const {
-            if (hdl == Handle::Null) {
-                return nullptr;
+            {
+                memory_epoch::guard g(_epoch);
+                if (auto obj = u_tryRetain(hdl)) {
+                    return object_stack_ref(obj, false);
+                }
             }
 
-            auto itr = _map.find(hdl);
-            if (itr != _map.end())
-                return itr->second;
+            if (_has_legacy_handles.load(std::memory_order_acquire)) {
+                // we really must own an object BEFORE read lock will be released
+                read_lock g(_mutex);
+                return u_getLegacyObject(hdl);
+            }
 
             return nullptr;
         }
 
+        object_base *u_getObject(Handle hdl) const {
+            auto obj = u_findObject(hdl);
+            return obj ? obj : u_getLegacyObject(hdl);
+        }
+
         void u_clear() {
-            _map.clear();
+            u_release_chunks();
             _idGen.u_clear();
-            _all_objects.clear();
+            _quarantine.clear();
+            _tags.u_clear();
+            u_renew_reservations();
+            _legacy_handles.clear();
+            _has_legacy_handles.store(false, std::memory_order_relaxed);
+            _object_count.store(0, std::memory_order_relaxed);
+            _public_count.store(0, std::memory_order_relaxed);
         }
 
-        all_objects_set& u_all_objects() {
-            return _all_objects;
+        object_range u_all_objects() const {
+            return object_range(*this);
         }
 
         size_t u_public_object_count() const {
-            return _map.size();
+            return _public_count.load(std::memory_order_relaxed);
         }
 
         size_t object_count() const {
-            read_lock guard(_mutex);
-            return _all_objects.size();
+            return _object_count.load(std::memory_order_relaxed);
+        }
+
+        // the slot table can be walked by index, e.g. when the walk gets split over time
+        uint32_t slot_count() const {
+            return u_capacity();
+        }
+
+        object_base *object_at(uint32_t index) const {
+            const slot *s = u_slot(index);
+            return s ? s->object.load(std::memory_order_acquire) : nullptr;
+        }
+
+        // Registers objects which were loaded from a save (or were created outside of the registry).
+        // A public object takes the slot its handle points to. If the slot is occupied already,
+        // the object gets a free slot and its handle gets remembered as a legacy one.
+        // The free slots get the @generations they had when the save was made
+        void u_placeLoadedObjects(const std::vector<object_base *>& objects, const std::vector<slot_generation>& generations = {}) {
+            std::vector<object_base *> unplaced;
+
+            for (auto obj : objects) {
+                const auto id = obj->_uid();
+                const auto index = handle_layout::index(id);
+
+                if (id != Handle::Null && index != 0 && !u_make_slot(index).object.load(std::memory_order_relaxed)) {
+                    u_placeObject(*obj, index);
+                    slot& s = *u_slot(index);
+                    s.generation = handle_layout::generation(id);
+                    s.handle.store(id, std::memory_order_relaxed);
+                    ++_public_count;
+                }
+                else {
+                    unplaced.push_back(obj);
+                }
+            }
+
+            std::vector<uint32_t> used;
+            used.reserve(object_count());
+            for (auto itr = u_all_objects().begin(), end = u_all_objects().end(); itr != end; ++itr) {
+                used.push_back((*itr)->_slot);
+            }
+
+            for (const auto& saved : generations) {
+                if (saved.index == 0 || saved.index > handle_layout::index_mask || saved.generation > handle_layout::retired_generation) {
+                    continue;
+                }
+                slot& s = u_make_slot(saved.index);
+                if (!s.object.load(std::memory_order_relaxed)) {
+                    s.generation = saved.generation;
+                    if (saved.generation == handle_layout::retired_generation) {
+                        used.push_back(saved.index);
+                    }
+                }
+            }
+            std::sort(used.begin(), used.end());
+            _idGen.u_assign_used_ids(used);
+            _quarantine.clear();
+            // the generator has forgotten about the reserved indices
+            u_renew_reservations();
+
+            for (auto obj : unplaced) {
+                const auto index = _idGen.new_id();
+                u_placeObject(*obj, index);
+
+                const auto id = obj->_uid();
+                if (id != Handle::Null) {
+                    u_slot(index)->handle.store(id, std::memory_order_relaxed);
+                    _legacy_handles[id] = index;
+                    ++_public_count;
+                }
+            }
+
+            _has_legacy_handles.store(!_legacy_handles.empty(), std::memory_order_release);
+
+            for (auto obj : objects) {
+                if (auto tag = obj->u_tag()) {
+                    _tags.add(*tag, *obj);
+                }
+            }
+        }
+
+    private:
+
+        // the calling thread's reservation for this registry. A thread keeps the reservations for a few registries,
+        // the least recently used one gets dropped (and its indices given back) once there are more of them
+        reservation& this_thread_reservation() {
+            static thread_local thread_reservations thread_local_reservations;
+            reservation *reservations = thread_local_reservations.items;
+            const uint64_t tag = _reservation_tag.load(std::memory_order_acquire);
+
+            for (uint32_t i = 0; i < reservations_per_thread; ++i) {
+                if (reservations[i].tag == tag) {
+                    // keeps the recently used ones in front
+                    std::rotate(reservations, reservations + i, reservations + i + 1);
+                    return reservations[0];
+                }
+            }
+
+            std::rotate(reservations, reservations + reservations_per_thread - 1, reservations + reservations_per_thread);
+            give_back(reservations[0]);
+            reservations[0].tag = tag;
+            return reservations[0];
+        }
+
+        static std::shared_ptr<reservation_owner> make_reservation_owner(object_registry& registry) {
+            auto owner = std::make_shared<reservation_owner>();
+            owner->registry = &registry;
+            return owner;
+        }
+
+        // returns the unused indices of the reservation to the registry it was made for, if the registry is still there
+        // and the indices are still valid
+        static void give_back(reservation& reserved) {
+            if (reserved.count != 0) {
+                if (auto owner = reserved.owner.lock()) {
+                    spinlock::guard g(owner->lock);
+                    if (owner->registry) {
+                        owner->registry->return_reserved(reserved);
+                    }
+                }
+            }
+            reserved.count = 0;
+            reserved.owner.reset();
+        }
+
+        void return_reserved(const reservation& reserved) {
+            write_lock g(_mutex);
+            if (reserved.tag == _reservation_tag.load(std::memory_order_relaxed)) {
+                for (uint32_t i = 0; i < reserved.count; ++i) {
+                    _idGen.reuse_id(reserved.indices[i]);
+                }
+            }
+        }
+
+        // the reservations issued so far will never be given back
+        void u_detach_reservations() {
+            spinlock::guard g(_reservation_owner->lock);
+            _reservation_owner->registry = nullptr;
         }
 
+        // invalidates the outstanding reservations
+        void u_renew_reservations() {
+            u_detach_reservations();
+            _reservation_owner = make_reservation_owner(*this);
+            _reservation_tag.store(new_reservation_tag(), std::memory_order_release);
+        }
+
+        // reserves as many indices as there are left. Throws std::length_error if the table is full -
+        // collection_base::make destroys the object which can't be registered
+        void u_reserve(reservation& reserved) {
+            write_lock g(_mutex);
+            if (!_idGen.has_free_id()) {
+                throw std::length_error("object_registry: all slots are in use");
+            }
+
+            uint32_t count = 0;
+            while (count < reservation_size && _idGen.has_free_id()) {
+                const uint32_t index = _idGen.new_id();
+                u_make_slot(index);
+                reserved.indices[count++] = index;
+            }
+            // the indices are handed out from the back, the lowest one goes last
+            std::reverse(reserved.indices, reserved.indices + count);
+            reserved.count = count;
+            reserved.owner = _reservation_owner;
+        }
+
+        uint32_t u_capacity() const {
+            return _chunk_limit.load(std::memory_order_acquire) * chunk_size;
+        }
+
+        slot* u_slot(uint32_t index) const {
+            slot *chunk = _chunks[(index & handle_layout::index_mask) / chunk_size].load(std::memory_order_acquire);
+            return chunk ? &chunk[index % chunk_size] : nullptr;
+        }
+
+        slot& u_make_slot(uint32_t index) {
+            const uint32_t chunk_index = (index & handle_layout::index_mask) / chunk_size;
+            slot *chunk = _chunks[chunk_index].load(std::memory_order_relaxed);
+            if (!chunk) {
+                chunk = new slot[chunk_size];
+                _chunks[chunk_index].store(chunk, std::memory_order_release);
+                if (_chunk_limit.load(std::memory_order_relaxed) <= chunk_index) {
+                    _chunk_limit.store(chunk_index + 1, std::memory_order_release);
+                }
+            }
+            return chunk[index % chunk_size];
+        }
+
+        void u_placeObject(object_base& obj, uint32_t index) {
+            jc_assert(obj._slot == 0);
+            slot& s = u_make_slot(index);
+            jc_assert(s.object.load(std::memory_order_relaxed) == nullptr);
+
+            obj._slot = index;
+            s.object.store(&obj, std::memory_order_release);
+            ++_object_count;
+        }
+
+        // lock-free lookup of a handle issued by the slot table
+        object_base *u_findObject(Handle hdl) const {
+            if (hdl == Handle::Null) {
+                return nullptr;
+            }
+
+            if (const slot *s = u_slot(handle_layout::index(hdl))) {
+                if (s->handle.load(std::memory_order_acquire) == hdl) {
+                    auto obj = s->object.load(std::memory_order_acquire);
+                    // re-check, the slot might have been recycled in between
+                    if (s->handle.load(std::memory_order_acquire) == hdl) {
+                        return obj;
+                    }
+                }
+            }
+
+            return nullptr;
+        }
+
+        // lock-free lookup which also retains the object found. Must be called within memory_epoch's critical section.
+        // Inside a stack_ref_batch, the object gets published in the batch's hazard slot instead of being counted
+        object_base *u_tryRetain(Handle hdl) const {
+            const slot *s = u_slot(handle_layout::index(hdl));
+            if (!s) {
+                return nullptr;
+            }
+
+            auto batch = stack_ref_batch::current();
+
+            // a deleter may unpublish the handle and then put it back, if it loses the race against us
+            for (int attempt = 0; attempt < 2; ++attempt) {
+                if (s->handle.load(std::memory_order_acquire) != hdl) {
+                    return nullptr;
+                }
+
+                object_base *obj = s->object.load(std::memory_order_acquire);
+                if (!obj) {
+                    return nullptr;
+                }
+
+                if (batch && batch->begin_lookup(*obj)) {
+                    if (s->handle.load(std::memory_order_seq_cst) == hdl) {
+                        obj->write_barrier();
+                        return obj;
+                    }
+                    batch->cancel_lookup(*obj);
+                    continue;
+                }
+
+                obj->add_ref<refs::stack>();
+                if (s->handle.load(std::memory_order_seq_cst) == hdl) {
+                    obj->write_barrier();
+                    return obj;
+                }
+                // the object is being deleted - silently take the reference back
+                obj->drop_ref<refs::stack>();
+            }
+
+            return nullptr;
+        }
+
+        object_base *u_getLegacyObject(Handle hdl) const {
+            auto itr = _legacy_handles.find(hdl);
+            return itr != _legacy_handles.end() ? u_slot(itr->second)->object.load(std::memory_order_relaxed) : nullptr;
+        }
+
+        void u_release_chunks() {
+            for (auto& chunk : _chunks) {
+                delete[] chunk.exchange(nullptr, std::memory_order_relaxed);
+            }
+            _chunk_limit.store(0, std::memory_order_relaxed);
+        }
+
+    public:
+
         friend class boost::serialization::access;
         BOOST_SERIALIZATION_SPLIT_MEMBER();
 
         template<class Archive>
         void save(Archive & ar, const unsigned int version) const {
-            jc_assert(version == 1);
-            ar << _all_objects << _idGen;
+            jc_assert(version == 3);
+            const std::vector<object_base *> objects(u_all_objects().begin(), u_all_objects().end());
+
+            std::vector<slot_generation> generations;
+            for (uint32_t index = 0, end = u_capacity(); index < end; ++index) {
+                const slot *s = u_slot(index);
+                if (s && s->generation != 0) {
+                    slot_generation saved;
+                    saved.index = index;
+                    saved.generation = s->generation;
+                    generations.push_back(saved);
+                }
+            }
+
+            ar << objects << generations;
         }
 
         template<class Archive>
         void load(Archive & ar, const unsigned int version) {
 
+            std::vector<object_base *> objects;
+            std::vector<slot_generation> generations;
+
             switch (version) {
             default:
                 jc_assert(false);
                 break;
-            case 1:
-                ar >> _all_objects >> _idGen;
-
-                for (auto& obj : _all_objects) {
-                    if (obj->is_public()) {
-                        _map.insert(registry_container::value_type(obj->_uid(), obj));
-                    }
-                }
+            case 3:
+                ar >> objects >> generations;
+                break;
+            case 2:
+                ar >> objects;
+                break;
+            case 1: {
+                std::unordered_set<object_base *> all_objects;
+                id_generator_type unused_idGen;
+                ar >> all_objects >> unused_idGen;
 
+                objects.assign(all_objects.begin(), all_objects.end());
                 break;
+            }
             case 0: {
                 typedef std::map<Handle, object_base *> registry_container_old;
                 registry_container_old oldCnt;
-                ar >> oldCnt >> _idGen;
+                id_generator_type unused_idGen;
+                ar >> oldCnt >> unused_idGen;
 
-                _map.insert(oldCnt.begin(), oldCnt.end());
-
-                std::transform(oldCnt.begin(), oldCnt.end(), std::inserter(_all_objects, _all_objects.begin()),
+                std::transform(oldCnt.begin(), oldCnt.end(), std::back_inserter(objects),
                     [](const registry_container_old::value_type& pair) {
                         return pair.second;
                     }
@@ -167,8 +724,10 @@ namespace collections
             }
                 break;
             }
+
+            u_placeLoadedObjects(objects, generations);
         }
     };
 }
 
-BOOST_CLASS_VERSION(collections::object_registry, 1);
+BOOST_CLASS_VERSION(collections::object_registry, 3);
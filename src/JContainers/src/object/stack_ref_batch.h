@@ -0,0 +1,269 @@
+#pragma once
+
+#include <atomic>
+#include <climits>
+#include <boost/noncopyable.hpp>
+
+namespace collections {
+
+    class object_base;
+
+    // Process-wide hazard slots. An object published in a slot can't be deleted: object_registry::u_removeObject
+    // refuses to remove it and the garbage collector treats it as a root
+    class hazard_table : boost::noncopyable {
+    public:
+
+        enum : uint32_t {
+            max_threads = 128,
+            slots_per_thread = 16,
+        };
+
+        // A slot's balance word: the number of the slot's publication in the high half, the balance biased
+        // by @balance_bias in the low one. Zero low half means closed - the slot is empty or the owning batch
+        // applies the balance to the counter. The number keeps a balance from being taken after the slot has got another object
+        enum : uint64_t {
+            balance_bias = 0x80000000,
+            balance_mask = 0xffffffff,
+        };
+
+        static uint64_t open_balance(uint64_t previous, int32_t balance) {
+            return ((previous >> 32) + 1) << 32 | uint64_t(int64_t(balance) + balance_bias);
+        }
+
+        static uint64_t closed_balance(uint64_t word) {
+            return word & ~uint64_t(balance_mask);
+        }
+
+        static bool is_closed(uint64_t word) {
+            return (word & balance_mask) == 0;
+        }
+
+        static int32_t balance_of(uint64_t word) {
+            return int32_t(int64_t(word & balance_mask) - int64_t(balance_bias));
+        }
+
+        struct record {
+            std::atomic<bool> in_use;
+            std::atomic<object_base*> slots[slots_per_thread];
+            std::atomic<uint64_t> balances[slots_per_thread]; // changed by the owner, decremented by anyone (see take_reference)
+        };
+
+        enum class take_result {
+            taken,
+            closing,    // the owner is applying the balance, the reference is about to be counted
+            absent,
+        };
+
+    private:
+
+        record _records[max_threads];
+        std::atomic<uint32_t> _high_water; // the records beyond it have never been used
+
+        hazard_table() : _high_water(0) {
+            for (auto& r : _records) {
+                r.in_use.store(false, std::memory_order_relaxed);
+                for (auto& s : r.slots) {
+                    s.store(nullptr, std::memory_order_relaxed);
+                }
+                for (auto& b : r.balances) {
+                    b.store(0, std::memory_order_relaxed); // closed
+                }
+            }
+        }
+
+        // gives a record to a thread for its whole life
+        struct thread_record : boost::noncopyable {
+            record *r = nullptr;
+            ~thread_record() {
+                if (r) {
+                    r->in_use.store(false, std::memory_order_release);
+                }
+            }
+        };
+
+        record* acquire() {
+            for (uint32_t i = 0; i < max_threads; ++i) {
+                bool free = false;
+                if (_records[i].in_use.compare_exchange_strong(free, true, std::memory_order_acquire)) {
+                    uint32_t hw = _high_water.load(std::memory_order_relaxed);
+                    while (hw < i + 1 && !_high_water.compare_exchange_weak(hw, i + 1, std::memory_order_seq_cst)) {}
+                    return &_records[i];
+                }
+            }
+            return nullptr;
+        }
+
+    public:
+
+        static hazard_table& instance() {
+            static hazard_table table;
+            return table;
+        }
+
+        // the calling thread's record, null if there are more than @max_threads threads
+        record* this_thread_record() {
+            static thread_local thread_record holder;
+            if (!holder.r) {
+                holder.r = acquire();
+            }
+            return holder.r;
+        }
+
+        bool is_protected(const object_base& obj) const {
+            const uint32_t count = _high_water.load(std::memory_order_seq_cst);
+            for (uint32_t i = 0; i < count; ++i) {
+                for (auto& s : _records[i].slots) {
+                    if (s.load(std::memory_order_seq_cst) == &obj) {
+                        return true;
+                    }
+                }
+            }
+            return false;
+        }
+
+        // A reference counted by a batch's balance may leave the batch's thread and get released elsewhere
+        // while the object's own counter is still zero. The release is taken out of a balance then -
+        // of any batch holding the object, the balances are applied to the same counter in the end
+        take_result take_reference(const object_base& obj) {
+            const uint32_t count = _high_water.load(std::memory_order_seq_cst);
+            for (uint32_t i = 0; i < count; ++i) {
+                for (uint32_t j = 0; j < slots_per_thread; ++j) {
+                    if (_records[i].slots[j].load(std::memory_order_seq_cst) != &obj) {
+                        continue;
+                    }
+                    auto& balance = _records[i].balances[j];
+                    for (;;) {
+                        uint64_t word = balance.load(std::memory_order_seq_cst);
+                        if (is_closed(word)) {
+                            return take_result::closing;
+                        }
+                        // a slot changes only while its balance is closed: the balance belongs to the object
+                        // if the slot still holds it, the failed exchange means the balance may have been reopened
+                        if (_records[i].slots[j].load(std::memory_order_seq_cst) != &obj) {
+                            break;
+                        }
+                        if (balance.compare_exchange_strong(word, word - 1, std::memory_order_seq_cst)) {
+                            return take_result::taken;
+                        }
+                    }
+                }
+            }
+            return take_result::absent;
+        }
+
+        // the objects are not to be touched - they may be gone as soon as they are seen
+        template<class Func>
+        void visit(Func&& func) const {
+            const uint32_t count = _high_water.load(std::memory_order_seq_cst);
+            for (uint32_t i = 0; i < count; ++i) {
+                for (auto& s : _records[i].slots) {
+                    if (auto obj = s.load(std::memory_order_seq_cst)) {
+                        func(obj);
+                    }
+                }
+            }
+        }
+    };
+
+    // Deferred stack reference counting for the duration of an API call.
+    //
+    // While a batch is active on a thread, object_stack_ref doesn't touch the objects' counters.
+    // The first reference to an object publishes it in the thread's hazard slots instead, the rest of retains
+    // and releases change the batch's balance only. When the batch ends, the balances get applied
+    // to the counters at once and the objects left without owners get their lifetime prolonged, as stack_release
+    // would do. Once the slots are exhausted, the references are counted as usual.
+    // The balances live in the hazard record, so a reference passed to another thread can be released there
+    // (see object_base::stack_release)
+    class stack_ref_batch : boost::noncopyable {
+
+        hazard_table::record *_record;
+        uint32_t _used = 0;
+        bool _active = false;
+        bool _lookup_published = false; // the latest begin_lookup has taken a new slot
+
+        static stack_ref_batch*& current_ref() {
+            static thread_local stack_ref_batch *batch = nullptr;
+            return batch;
+        }
+
+        int32_t find(const object_base& obj) const {
+            for (uint32_t i = 0; i < _used; ++i) {
+                if (_record->slots[i].load(std::memory_order_relaxed) == &obj) {
+                    return static_cast<int32_t>(i);
+                }
+            }
+            return -1;
+        }
+
+        int32_t publish(object_base& obj, int32_t balance) {
+            if (_used == hazard_table::slots_per_thread) {
+                return -1;
+            }
+            // the slot first - the balance opens for the object once it's there
+            auto& word = _record->balances[_used];
+            _record->slots[_used].store(&obj, std::memory_order_seq_cst);
+            word.store(hazard_table::open_balance(word.load(std::memory_order_relaxed), balance), std::memory_order_seq_cst);
+            return static_cast<int32_t>(_used++);
+        }
+
+        void add_balance(int32_t idx, int32_t delta) {
+            _record->balances[idx].fetch_add(uint64_t(int64_t(delta)), std::memory_order_relaxed);
+        }
+
+        // the balance can't be changed by the other threads after this
+        int32_t close_balance(uint32_t idx) {
+            auto& word = _record->balances[idx];
+            uint64_t current = word.load(std::memory_order_relaxed);
+            while (!word.compare_exchange_weak(current, hazard_table::closed_balance(current), std::memory_order_seq_cst)) {}
+            return hazard_table::balance_of(current);
+        }
+
+    public:
+
+        // a batch nested into another one does nothing
+        stack_ref_batch() : _record(hazard_table::instance().this_thread_record()) {
+            auto& cur = current_ref();
+            if (!cur && _record) {
+                cur = this;
+                _active = true;
+            }
+        }
+
+        ~stack_ref_batch();
+
+        static stack_ref_batch* current() {
+            return current_ref();
+        }
+
+        // true if the batch has taken the reference over. The object must be referenced by the caller
+        bool retain(object_base& obj);
+
+        // true if the batch has taken the release over
+        bool release(object_base& obj) {
+            auto idx = find(obj);
+            if (idx >= 0) {
+                add_balance(idx, -1);
+                return true;
+            }
+            // the reference being released keeps the object alive until it's published
+            return publish(obj, -1) >= 0;
+        }
+
+        // for a lookup which can't guarantee the object is alive: publishes the object, the caller re-validates
+        // the lookup then and calls @cancel_lookup if it fails. False if there's no room for the object
+        bool begin_lookup(object_base& obj) {
+            auto idx = find(obj);
+            if (idx >= 0) {
+                add_balance(idx, 1);
+                _lookup_published = false;
+                return true;
+            }
+            _lookup_published = publish(obj, 1) >= 0;
+            return _lookup_published;
+        }
+
+        void cancel_lookup(object_base& obj);
+
+        uint32_t u_object_count() const { return _used; }
+    };
+}
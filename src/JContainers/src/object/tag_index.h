@@ -0,0 +1,104 @@
+#pragma once
+
+#include <unordered_map>
+#include <unordered_set>
+#include <boost/noncopyable.hpp>
+
+#include "util/istring.h"
+
+namespace collections {
+
+    class object_base;
+
+    // Tagged objects grouped by their tags. Tags are compared case-insensitively, as object_base::has_equal_tag does.
+    // The index doesn't own the objects: object_registry takes an object out of it before the object gets deleted.
+    // The index remembers the tag of each object itself, so the removal never reads the object's tag, which
+    // object_base::set_tag may be changing at the same moment
+    class tag_index : boost::noncopyable {
+
+        struct tag_hash {
+            size_t operator () (const util::istring& tag) const {
+                return util::case_folded_hash(tag.c_str(), tag.size());
+            }
+        };
+
+        typedef std::unordered_set<object_base *> object_set;
+
+        std::unordered_map<util::istring, object_set, tag_hash> _objects;
+        std::unordered_map<const object_base *, util::istring> _tag_of;
+        mutable util::spinlock _mutex;
+
+        void u_add(const util::istring& tag, object_base& obj) {
+            _objects[tag].insert(&obj);
+            _tag_of[&obj] = tag;
+        }
+
+        void u_remove(object_base& obj) {
+            auto tagged = _tag_of.find(&obj);
+            if (tagged == _tag_of.end()) {
+                return;
+            }
+
+            auto itr = _objects.find(tagged->second);
+            if (itr != _objects.end()) {
+                itr->second.erase(&obj);
+                if (itr->second.empty()) {
+                    _objects.erase(itr);
+                }
+            }
+            _tag_of.erase(tagged);
+        }
+
+    public:
+
+        void add(const util::istring& tag, object_base& obj) {
+            util::spinlock::guard g(_mutex);
+            u_remove(obj);
+            u_add(tag, obj);
+        }
+
+        // re-indexes @obj under @tag (an empty one drops the object), unless @is_indexable, called with the index locked,
+        // tells that the object has left the registry already
+        template<class Predicate>
+        void retag(object_base& obj, const util::istring& tag, Predicate&& is_indexable) {
+            util::spinlock::guard g(_mutex);
+            if (!is_indexable()) {
+                return;
+            }
+            u_remove(obj);
+            if (!tag.empty()) {
+                u_add(tag, obj);
+            }
+        }
+
+        // takes @obj out of the index. @on_removed runs with the index still locked - once it has marked the object
+        // as unregistered, no retag can put the object back
+        template<class Func>
+        void remove(object_base& obj, Func&& on_removed) {
+            util::spinlock::guard g(_mutex);
+            u_remove(obj);
+            on_removed();
+        }
+
+        // calls @func for each object tagged with @tag, with the index locked
+        template<class Func>
+        void for_each(const char *tag, Func&& func) const {
+            util::spinlock::guard g(_mutex);
+            auto itr = _objects.find(util::istring(tag));
+            if (itr != _objects.end()) {
+                for (auto obj : itr->second) {
+                    func(*obj);
+                }
+            }
+        }
+
+        size_t u_tag_count() const {
+            return _objects.size();
+        }
+
+        void u_clear() {
+            _objects.clear();
+            _tag_of.clear();
+        }
+    };
+}
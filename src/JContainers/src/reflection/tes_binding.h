@@ -134,6 +134,13 @@ namespace reflection { namespace binding {
     template<class T>
     using convert_to_tes_type = typename get_converter<T>::tes_type;
 
+    // Lives through a whole call of a native function with a state, including the conversion of its arguments
+    // and of its result. A state may specialize it to do something once per call
+    template<class State>
+    struct call_scope {
+        explicit call_scope(State&) {}
+    };
+
     // Template monster, proxy class that:
     // - adapts my internal types to native Papyrus types and vica versa
     // - generates native Papyrus function
@@ -170,6 +177,7 @@ namespace reflection { namespace binding {
                     StaticFunctionTag* tag,
                     convert_to_tes_type<Params> ... params)
                 {
+                    call_scope<State> scope(state);
                     return GetConv<R>::convert2Tes(
                         func(
                             get_converter<Params>::convert2J(params, tag) ...
@@ -253,6 +261,7 @@ namespace reflection { namespace binding {
                     State& state,
                     convert_to_tes_type<Params> ... params)
                 {
+                    call_scope<State> scope(state);
                     func(state, get_converter<Params>::convert2J(params, state) ...);
                 }
             };
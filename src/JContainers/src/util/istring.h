@@ -1,6 +1,9 @@
 #pragma once
 
 #include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <string>
 
 namespace util {
 
@@ -28,4 +31,17 @@ namespace util {
     };
 
     typedef std::basic_string<char, istring_traits, std::allocator<char> > istring;
+
+    // FNV-1a of the lower-case string - strings equal for istring_traits have equal hashes
+    inline uint32_t case_folded_hash(const char *str, size_t length) {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < length; ++i) {
+            hash = (hash ^ uint8_t(tolower(uint8_t(str[i])))) * 16777619u;
+        }
+        return hash;
+    }
+
+    inline uint32_t case_folded_hash(const char *str) {
+        return case_folded_hash(str, strlen(str));
+    }
 }
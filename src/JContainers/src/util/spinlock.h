@@ -1,30 +1,349 @@
 #pragma once
 
 #include <atomic>
+#include <algorithm>
 #include <mutex>
+#include <condition_variable>
 #include <type_traits>
+#include <emmintrin.h>
 
 namespace util {
 
-    class spinlock
+    // A snapshot of lock contention counters
+    struct lock_contention {
+        uint64_t contended = 0;     // lock() calls which have not got the lock immediately
+        uint64_t spins = 0;         // pause instructions executed while waiting
+        uint64_t parks = 0;         // times a waiting thread went to sleep
+
+        lock_contention& operator += (const lock_contention& other) {
+            contended += other.contended;
+            spins += other.spins;
+            parks += other.parks;
+            return *this;
+        }
+    };
+
+    namespace detail {
+
+        struct contention_counters {
+            std::atomic<uint64_t> contended{ 0 };
+            std::atomic<uint64_t> spins{ 0 };
+            std::atomic<uint64_t> parks{ 0 };
+
+            void add(uint64_t spin_count, uint64_t park_count) {
+                contended.fetch_add(1, std::memory_order_relaxed);
+                spins.fetch_add(spin_count, std::memory_order_relaxed);
+                parks.fetch_add(park_count, std::memory_order_relaxed);
+            }
+
+            lock_contention snapshot() const {
+                lock_contention c;
+                c.contended = contended.load(std::memory_order_relaxed);
+                c.spins = spins.load(std::memory_order_relaxed);
+                c.parks = parks.load(std::memory_order_relaxed);
+                return c;
+            }
+        };
+
+        // no per-lock counters
+        struct no_contention_counters {
+            void add(uint64_t, uint64_t) {}
+            lock_contention snapshot() const { return lock_contention(); }
+        };
+
+        // all locks together, the only counters updated for locks without their own ones
+        inline contention_counters& global_contention_counters() {
+            static contention_counters counters;
+            return counters;
+        }
+
+        // Futex-like sleeping on an address. Waiters of a lock sleep on one of a fixed amount
+        // of condition variables - so that a lock itself costs one byte
+        class parking_lot {
+            struct bucket {
+                std::mutex mutex;
+                std::condition_variable condition;
+            };
+
+            enum { bucket_count = 64 };
+            bucket _buckets[bucket_count];
+
+            bucket& bucket_of(const void *address) {
+                return _buckets[(reinterpret_cast<uintptr_t>(address) >> 4) % bucket_count];
+            }
+
+        public:
+
+            static parking_lot& instance() {
+                static parking_lot lot;
+                return lot;
+            }
+
+            // sleeps if @should_sleep (checked under the bucket's lock) returns true. May wake up spuriously
+            template<class Predicate>
+            void park(const void *address, Predicate should_sleep) {
+                auto& b = bucket_of(address);
+                std::unique_lock<std::mutex> guard(b.mutex);
+                if (should_sleep()) {
+                    b.condition.wait(guard);
+                }
+            }
+
+            void unpark_all(const void *address) {
+                auto& b = bucket_of(address);
+                {
+                    // a waiter either hasn't checked its predicate yet or already sleeps
+                    std::lock_guard<std::mutex> guard(b.mutex);
+                }
+                b.condition.notify_all();
+            }
+        };
+    }
+
+    // Spins with an exponential backoff for a short while, then parks the thread until the lock
+    // gets released. @Counters is where contention gets accounted, in addition to the global counters
+    template<class Counters>
+    class basic_spinlock : private Counters
     {
-        std::atomic_flag _lock;
+        enum : uint8_t {
+            locked = 1,
+            parked = 2, // someone sleeps waiting for the lock
+        };
+
+        enum : uint32_t {
+            spin_rounds = 12,
+            max_backoff = 64,
+        };
+
+        std::atomic<uint8_t> _state;
 
     public:
 
-        spinlock() {
-            _lock._My_flag = 0;
+        basic_spinlock() : _state(0) {}
+
+        void lock() {
+            uint8_t free = 0;
+            if (!_state.compare_exchange_strong(free, locked, std::memory_order_acquire, std::memory_order_relaxed)) {
+                lock_slow();
+            }
+        }
+
+        bool try_lock() {
+            uint8_t free = 0;
+            return _state.compare_exchange_strong(free, locked, std::memory_order_acquire, std::memory_order_relaxed);
+        }
+
+        void unlock() {
+            if (_state.exchange(0, std::memory_order_release) & parked) {
+                detail::parking_lot::instance().unpark_all(this);
+            }
+        }
+
+        // the lock's own contention counters, if it has them
+        lock_contention contention() const {
+            return Counters::snapshot();
+        }
+
+        typedef std::lock_guard<basic_spinlock> guard;
+
+    private:
+
+        void lock_slow() {
+            uint64_t spins = 0, parks = 0;
+            // a thread which has slept once can't know whether it was the last waiter
+            uint8_t acquired_state = locked;
+
+            for (uint32_t round = 0;; ++round) {
+                uint8_t state = _state.load(std::memory_order_relaxed);
+                if ((state & locked) == 0) {
+                    if (_state.compare_exchange_weak(state, state | acquired_state, std::memory_order_acquire, std::memory_order_relaxed)) {
+                        break;
+                    }
+                    continue;
+                }
+
+                if (round < spin_rounds) {
+                    const uint32_t backoff = (std::min)(uint32_t(1) << round, uint32_t(max_backoff));
+                    for (uint32_t i = 0; i < backoff; ++i) {
+                        _mm_pause();
+                    }
+                    spins += backoff;
+                    continue;
+                }
+
+                if ((state & parked) == 0 &&
+                    !_state.compare_exchange_weak(state, state | parked, std::memory_order_relaxed, std::memory_order_relaxed))
+                {
+                    continue;
+                }
+
+                ++parks;
+                detail::parking_lot::instance().park(this, [this]() {
+                    return _state.load(std::memory_order_relaxed) == (locked | parked);
+                });
+                acquired_state = locked | parked;
+            }
+
+            detail::global_contention_counters().add(spins, parks);
+            Counters::add(spins, parks);
         }
+    };
+
+    // Many readers or a single writer, otherwise behaves like basic_spinlock.
+    // A writer waiting for the lock stops new readers from coming in, so that writers never starve.
+    // Not recursive: a reader must not take the lock again, even for reading
+    template<class Counters>
+    class basic_rw_spinlock : private Counters
+    {
+        enum : uint32_t {
+            writer = 1u << 31,
+            writer_waiting = 1u << 30,
+            parked = 1u << 29,
+            readers_mask = parked - 1,
+        };
+
+        enum : uint32_t {
+            spin_rounds = 12,
+            max_backoff = 64,
+        };
+
+        std::atomic<uint32_t> _state;
+
+    public:
+
+        basic_rw_spinlock() : _state(0) {}
 
         void lock() {
-            while(_lock.test_and_set(std::memory_order_acquire))  // acquire lock
-                ; // spin
+            if (!try_lock()) {
+                lock_slow();
+            }
+        }
+
+        bool try_lock() {
+            uint32_t free = 0;
+            return _state.compare_exchange_strong(free, writer, std::memory_order_acquire, std::memory_order_relaxed);
         }
 
         void unlock() {
-            _lock.clear(std::memory_order_release);  
+            if (_state.fetch_and(~(writer | parked), std::memory_order_release) & parked) {
+                detail::parking_lot::instance().unpark_all(this);
+            }
+        }
+
+        void lock_shared() {
+            uint32_t state = _state.load(std::memory_order_relaxed);
+            if ((state & (writer | writer_waiting)) != 0 ||
+                !_state.compare_exchange_weak(state, state + 1, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                lock_shared_slow();
+            }
+        }
+
+        void unlock_shared() {
+            const uint32_t state = _state.fetch_sub(1, std::memory_order_release);
+            // the last reader lets a waiting writer in
+            if ((state & readers_mask) == 1 && (state & parked)) {
+                _state.fetch_and(~parked, std::memory_order_relaxed);
+                detail::parking_lot::instance().unpark_all(this);
+            }
+        }
+
+        // the lock's own contention counters, if it has them
+        lock_contention contention() const {
+            return Counters::snapshot();
         }
 
-        typedef std::lock_guard<spinlock> guard;
+        typedef std::lock_guard<basic_rw_spinlock> guard;
+
+        class shared_guard {
+            basic_rw_spinlock& _lock;
+            shared_guard(const shared_guard&);
+            shared_guard& operator = (const shared_guard&);
+        public:
+            explicit shared_guard(basic_rw_spinlock& lock) : _lock(lock) { _lock.lock_shared(); }
+            ~shared_guard() { _lock.unlock_shared(); }
+        };
+
+    private:
+
+        void lock_slow() {
+            uint64_t spins = 0, parks = 0;
+            for (uint32_t round = 0;; ++round) {
+                uint32_t state = _state.load(std::memory_order_relaxed);
+                if ((state & (writer | readers_mask)) == 0) {
+                    // sleepers, if any, still need the parked flag
+                    if (_state.compare_exchange_weak(state, (state & parked) | writer, std::memory_order_acquire, std::memory_order_relaxed)) {
+                        break;
+                    }
+                    continue;
+                }
+                if ((state & writer_waiting) == 0) {
+                    _state.compare_exchange_weak(state, state | writer_waiting, std::memory_order_relaxed, std::memory_order_relaxed);
+                    continue;
+                }
+                wait(round, spins, parks, [](uint32_t st) { return (st & (writer | readers_mask)) != 0; });
+            }
+            account(spins, parks);
+        }
+
+        void lock_shared_slow() {
+            uint64_t spins = 0, parks = 0;
+            for (uint32_t round = 0;; ++round) {
+                uint32_t state = _state.load(std::memory_order_relaxed);
+                if ((state & (writer | writer_waiting)) == 0) {
+                    if (_state.compare_exchange_weak(state, state + 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+                        break;
+                    }
+                    continue;
+                }
+                wait(round, spins, parks, [](uint32_t st) { return (st & (writer | writer_waiting)) != 0; });
+            }
+            account(spins, parks);
+        }
+
+        // spins a bit or sleeps while @blocked(state)
+        template<class Blocked>
+        void wait(uint32_t round, uint64_t& spins, uint64_t& parks, Blocked blocked) {
+            if (round < spin_rounds) {
+                const uint32_t backoff = (std::min)(uint32_t(1) << round, uint32_t(max_backoff));
+                for (uint32_t i = 0; i < backoff; ++i) {
+                    _mm_pause();
+                }
+                spins += backoff;
+                return;
+            }
+
+            uint32_t state = _state.load(std::memory_order_relaxed);
+            if (!blocked(state)) {
+                return;
+            }
+            if ((state & parked) == 0 &&
+                !_state.compare_exchange_weak(state, state | parked, std::memory_order_relaxed, std::memory_order_relaxed))
+            {
+                return;
+            }
+
+            ++parks;
+            detail::parking_lot::instance().park(this, [this, &blocked]() {
+                const uint32_t state = _state.load(std::memory_order_relaxed);
+                return (state & parked) != 0 && blocked(state);
+            });
+        }
+
+        void account(uint64_t spins, uint64_t parks) {
+            detail::global_contention_counters().add(spins, parks);
+            Counters::add(spins, parks);
+        }
     };
+
+    // the lock of each object - no own counters, contention is accounted globally only
+    typedef basic_spinlock<detail::no_contention_counters> spinlock;
+    typedef basic_rw_spinlock<detail::no_contention_counters> rw_spinlock;
+    // a lock of a shared structure, the contention of which is worth watching separately
+    typedef basic_spinlock<detail::contention_counters> counted_spinlock;
+
+    // contention of all locks since the start
+    inline lock_contention global_lock_contention() {
+        return detail::global_contention_counters().snapshot();
+    }
 }
@@ -1,5 +1,14 @@
 #include <boost/filesystem/path.hpp>
 #include <windef.h>
+#include <psapi.h>
+#include <jansson.h>
+
+#include "jcontainers_constants.h"
+#include "util/util.h"
+#include "util/singleton.h"
+#include "util/worker_pool.h"
+
+#pragma comment(lib, "psapi.lib")
 
 namespace util {
 
@@ -22,6 +31,35 @@ namespace util {
         auto imagePath = dll_path();
         return (imagePath.remove_filename() /= relative_path);
     }
+
+    size_t process_memory_usage() {
+        PROCESS_MEMORY_COUNTERS counters = { 0 };
+        counters.cb = sizeof(counters);
+        return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.WorkingSetSize : 0;
+    }
+
+    const plugin_settings& settings() {
+        static const plugin_settings loaded = []() {
+            plugin_settings st;
+            auto path = relative_to_dll_path(JC_DATA_FILES "settings.json").generic_string();
+
+            json_error_t error;
+            if (json_t *root = json_load_file(path.c_str(), 0, &error)) {
+                json_t *threads = json_object_get(root, "workerThreads");
+                if (json_is_integer(threads) && json_integer_value(threads) >= 0) {
+                    st.worker_threads = uint32_t(json_integer_value(threads));
+                }
+                json_decref(root);
+            }
+            return st;
+        }();
+        return loaded;
+    }
+
+    worker_pool& background_workers() {
+        static singleton<worker_pool> pool{ []() { return new worker_pool(settings().worker_threads); } };
+        return pool.get();
+    }
 }
 
 //////////////////////////////////////////////////////////////////////////
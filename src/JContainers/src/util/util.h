@@ -14,6 +14,15 @@ namespace util {
     boost::filesystem::path dll_path();
     boost::filesystem::path relative_to_dll_path(const char *relative_path);
 
+    // working set size of the process, in bytes
+    size_t process_memory_usage();
+
+    // JCData/settings.json, read once. Missing or invalid values keep their defaults
+    struct plugin_settings {
+        uint32_t worker_threads = 0;    // "workerThreads", size of the background worker pool. 0 - depends on the amount of cores
+    };
+    const plugin_settings& settings();
+
     template<class T>
     void do_with_timing(const char *operation_name, T&& func) {
         assert(operation_name);
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <type_traits>
+#include <thread>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/asio/io_service.hpp>
+#include <boost/asio/strand.hpp>
+#include "common/IThread.h"
+
+namespace util {
+
+#   define WINE_SUPPORT 1
+
+    // Threads which run the jobs subsystems move off Papyrus threads. A job is any callable,
+    // jobs may run in parallel and in any order. Work that must not overlap goes through @serial strand.
+    // The save isn't a job - see domain_master's write_to_stream
+    class worker_pool : boost::noncopyable {
+    public:
+
+        struct stats {
+            uint32_t thread_count = 0;
+            uint64_t queue_depth = 0;   // jobs submitted but not started yet
+            uint64_t jobs_done = 0;
+            uint64_t total_wait_us = 0; // from the submission till the start of a job
+            uint64_t max_wait_us = 0;
+            uint64_t total_run_us = 0;
+            uint64_t max_run_us = 0;
+        };
+
+        enum : uint32_t {
+            max_threads = 16,
+        };
+
+        static uint32_t default_thread_count() {
+            return (std::max)(1u, (std::min)(std::thread::hardware_concurrency() / 2, 4u));
+        }
+
+    private:
+
+        typedef std::chrono::steady_clock clock;
+
+        boost::asio::io_service _io;
+        boost::asio::io_service::work _work;
+        boost::asio::io_service::strand _serial;
+#   if WINE_SUPPORT
+        std::vector<std::unique_ptr<IThread>> _threads;
+#   else
+        std::vector<std::thread> _threads;
+#   endif
+
+        std::atomic<uint64_t> _queue_depth{ 0 };
+        std::atomic<uint64_t> _jobs_done{ 0 };
+        std::atomic<uint64_t> _total_wait_us{ 0 };
+        std::atomic<uint64_t> _max_wait_us{ 0 };
+        std::atomic<uint64_t> _total_run_us{ 0 };
+        std::atomic<uint64_t> _max_run_us{ 0 };
+
+        static uint64_t microseconds_since(clock::time_point since) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - since).count();
+        }
+
+        static void update_max(std::atomic<uint64_t>& max, uint64_t value) {
+            uint64_t current = max.load(std::memory_order_relaxed);
+            while (current < value && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {}
+        }
+
+    public:
+
+        // @thread_count of zero means default_thread_count
+        explicit worker_pool(uint32_t thread_count) : _io(), _work(_io), _serial(_io) {
+            thread_count = thread_count ? (std::min)(thread_count, uint32_t(max_threads)) : default_thread_count();
+            for (uint32_t i = 0; i < thread_count; ++i) {
+#   if WINE_SUPPORT
+                using io_ptr_type = decltype(_io);
+                _threads.emplace_back(new IThread());
+                _threads.back()->Start([](void *io_ptr) { reinterpret_cast<io_ptr_type*>(io_ptr)->run(); }, &_io);
+#   else
+                _threads.emplace_back([this]() { _io.run(); });
+#   endif
+            }
+        }
+
+        ~worker_pool() {
+            _io.stop();
+#   if WINE_SUPPORT
+            for (auto& thread : _threads) {
+                thread->Stop();
+                WaitForSingleObject(thread->GetHandle(), INFINITE);
+            }
+#   else
+            for (auto& thread : _threads) {
+                if (thread.joinable()) {
+                    thread.join();
+                }
+            }
+#   endif
+        }
+
+        // the timers of the subsystems run on the pool's io_service
+        boost::asio::io_service& io_service() {
+            return _io;
+        }
+
+        // the jobs and timer handlers wrapped by the strand never run at the same time
+        boost::asio::io_service::strand& serial() {
+            return _serial;
+        }
+
+        template<class Job>
+        void submit(Job&& job) {
+            _queue_depth.fetch_add(1, std::memory_order_relaxed);
+            const auto submitted = clock::now();
+            // asio copies handlers, a job may be move-only
+            auto shared_job = std::make_shared<typename std::decay<Job>::type>(std::forward<Job>(job));
+
+            _io.post([this, submitted, shared_job]() {
+                _queue_depth.fetch_sub(1, std::memory_order_relaxed);
+                const uint64_t waited = microseconds_since(submitted);
+                const auto started = clock::now();
+
+                (*shared_job)();
+
+                const uint64_t ran = microseconds_since(started);
+                _jobs_done.fetch_add(1, std::memory_order_relaxed);
+                _total_wait_us.fetch_add(waited, std::memory_order_relaxed);
+                _total_run_us.fetch_add(ran, std::memory_order_relaxed);
+                update_max(_max_wait_us, waited);
+                update_max(_max_run_us, ran);
+            });
+        }
+
+        uint32_t thread_count() const {
+            return uint32_t(_threads.size());
+        }
+
+        stats get_stats() const {
+            stats st;
+            st.thread_count = thread_count();
+            st.queue_depth = _queue_depth.load(std::memory_order_relaxed);
+            st.jobs_done = _jobs_done.load(std::memory_order_relaxed);
+            st.total_wait_us = _total_wait_us.load(std::memory_order_relaxed);
+            st.max_wait_us = _max_wait_us.load(std::memory_order_relaxed);
+            st.total_run_us = _total_run_us.load(std::memory_order_relaxed);
+            st.max_run_us = _max_run_us.load(std::memory_order_relaxed);
+            return st;
+        }
+    };
+
+    // the pool shared by all subsystems, sized by the "workerThreads" setting
+    worker_pool& background_workers();
+}